@@ -14,6 +14,7 @@
 use strict;
 use warnings;
 use FindBin qw($Bin);
+use Getopt::Long;
 
 
 #----------------------------------------#
@@ -29,6 +30,13 @@ my $taxfile = "";
 my $pre = "";
 my $nump = 0;
 my $blast = "";
+my $resume = 0;
+my $budget = 0;
+my $coarse = 8;
+my $collapse = 0;
+my $genes = 0;
+GetOptions("resume" => \$resume, "adaptive=i" => \$budget, "collapse=f" => \$collapse,
+	   "genes" => \$genes) or Usage();
 if (scalar @ARGV == 8) {
 
     if    ($ARGV[0] eq "norm") { $norm = "true";}
@@ -38,8 +46,24 @@ if (scalar @ARGV == 8) {
 } else {
     Usage();
 }
+if ($genes && ($blast ne "blastn" || $budget > 0)) { Usage();}
 #----------------------------------------#
 
+# collapse identical and near-identical reference genes: reads are still
+# simulated from all genes, with their own labels, but aligned to and trained
+# on the genes kept, labeled with the lowest common ancestor of the genes
+# each stands for
+my $cmd = "";
+my $qtax = "";
+if ($collapse > 0) {
+    my $prot = $rfile ne $qfile ? " $rfile" : "";
+    $cmd = "$Bin/collapseMarkers -i $collapse $qfile $taxfile $pre.collapsed$prot";
+    runStep($cmd, "$pre.collapsed.map");
+    $rfile   = $rfile ne $qfile ? "$pre.collapsed.protein" : "$pre.collapsed.dna";
+    $qtax    = " -q $taxfile";
+    $taxfile = "$pre.collapsed.taxonomy";
+}
+
 # format blast database and run blast
 my $p = "F";
 my $param = "-FF -W15 -a$nump";
@@ -47,7 +71,7 @@ if ($blast eq "blastx" || $blast eq "blastp") {
     $p = "T";
     $param = "";
 }
-my $cmd = "formatdb -p $p -i $rfile";
+$cmd = "formatdb -p $p -i $rfile";
 print "$cmd\n";
 system("$cmd");
 
@@ -57,31 +81,82 @@ if (-e $outfile) {
     system("rm $outfile");
 }
 
+# whole genes are aligned once for all lengths; reads are scored on these
+# alignments with the E-value cutoff of reads, so genes are kept at any
+if ($genes) {
+    $cmd = "blastall -p $blast $param -e10 -m8 -b1000 -v1000 -i $qfile -d $rfile > $pre.genes.$blast";
+    runStep($cmd, "$pre.genes.$blast");
+}
+
+# each length is trained into its own file; with --resume,
+# steps that finished before an interruption are not run again
 foreach my $len (@lens) {
 
     my $prefix = "$pre.$len";
-# simulate reads
+    if ($genes) {
+	$cmd = "$Bin/metaphylerTrain -g $qfile -s $step$qtax norm $taxfile $rfile $pre.genes.$blast $len $blast > $prefix.$blast.classifier";
+	runStep($cmd, "$prefix.$blast.classifier");
+	next;
+    }
+
+# simulate reads; in adaptive mode, pilot reads are aligned first,
+# and tell where in each gene reads should be dense
     my $cmd = "$Bin/simuReads $len $step $qfile > $prefix.fasta";
-    print "$cmd\n";
-    system("$cmd");
+    if ($budget > 0) {
+	my $pstep = $step * $coarse;
+	$cmd = "$Bin/simuReads $len $pstep $qfile > $prefix.pilot.fasta";
+	runStep($cmd, "$prefix.pilot.fasta");
+
+	$cmd = "blastall -p $blast $param -e1e-3 -m8 -b1000 -v1000 -i $prefix.pilot.fasta -d $rfile > $prefix.pilot.$blast";
+	runStep($cmd, "$prefix.pilot.$blast");
+
+	$cmd = "$Bin/simuReads -a $budget -c $coarse -p $prefix.pilot.$blast $len $step $qfile > $prefix.fasta";
+    }
+    runStep($cmd, "$prefix.fasta");
     
 $cmd = "blastall -p $blast $param -e1e-3 -m8 -b1000 -v1000 -i $prefix.fasta -d $rfile > $prefix.$blast";
-    print "$cmd\n";
-    system("$cmd");
+    runStep($cmd, "$prefix.$blast");
     
 # train model
-    $cmd = "$Bin/metaphylerTrain norm $taxfile $rfile $prefix.$blast $len $blast >> $pre.$blast.classifier";
+    $cmd = "$Bin/metaphylerTrain$qtax norm $taxfile $rfile $prefix.$blast $len $blast > $prefix.$blast.classifier";
+    runStep($cmd, "$prefix.$blast.classifier");
+    
+}
+
+# put models of all lengths together
+foreach my $len (@lens) {
+    my $cmd = "cat $pre.$len.$blast.classifier >> $outfile";
     print "$cmd\n";
     system("$cmd");
-    
 }
+unlink(glob("$pre.*.done"));
 exit;
 
 
+# run a step, unless --resume is given and it finished before,
+# i.e., its output has a .done file
+sub runStep {
+    my ($cmd, $output) = @_;
+
+    if ($resume && -e "$output.done") {
+	print "Done before: $cmd\n";
+	return;
+    }
+    unlink("$output.done");
+
+    print "$cmd\n";
+    system("$cmd");
+    die("Failed: $cmd\nRun again with --resume to continue from here.\n") if ($? != 0);
+
+    open(DONE, ">$output.done") or die("Could not open file $output.done\n");
+    close(DONE);
+}
+
+
 sub Usage {
     die("
 Usage:
-       perl buildMetaphyler.pl <norm|unnorm> <fasta 1> <fasta 2> <lengths> <taxonomy> <blast> <prefix> <# threads>
+       perl buildMetaphyler.pl [--resume] [--adaptive <budget> | --genes] <norm|unnorm> <fasta 1> <fasta 2> <lengths> <taxonomy> <blast> <prefix> <# threads>
 
 Options:
        <norm|unnorm>  Perform normalization (true) or not (false).
@@ -94,6 +169,22 @@ Options:
        <taxonomy>     Taxonomy labels of sequences in <fasta 2>.
        <prefix>       Output prefix.
        <# threads>    Number of threads to run BLAST.
+       --resume       Continue an interrupted build with the same arguments.
+		      Lengths and steps that finished are not run again.
+       --adaptive     Simulate at most about <budget> reads per gene: pilot reads,
+		      $coarse times as far apart, are aligned first, and reads are dense
+		      where their hits change along a gene, sparse elsewhere.
+       --collapse <identity>
+		      Keep one of each group of reference genes identical or at least
+		      this identical (e.g., 0.99) to each other, labeled with their
+		      lowest common ancestor. <fasta 1> must be DNA; for blastx,
+		      <fasta 2> are its proteins, by the same IDs. Models are trained
+		      on prefix.collapsed.dna (or .protein) and .taxonomy; install
+		      those as the markers with the models. prefix.collapsed.map
+		      lists the gene kept for every gene.
+       --genes        blastn only: align whole genes of <fasta 1> once, instead of
+		      simulated reads of each length, and score the reads every
+		      $step bases of each gene on those alignments.
 
 Contact:
         Have problems? Contact Bo Liu - boliu\@umiacs.umd.edu
@@ -23,37 +23,8 @@ if (scalar @ARGV == 0) {
 #----------------------------------------#
 
 
-my %tax = ();
-my %sams = ();
-foreach my $file (@ARGV) {
-    $file =~ /^(\S+?)\./;
-    my $sam = $1;
-    $sams{$sam} = 1;
-    
-    open(FH, "$file");
-    foreach my $line (<FH>) {
-	if ($line =~ /^Name/) {
-	    next;
-	}
-	my ($id, $pct) = split("\t", $line);
-	$tax{$id}{$sam} = $pct;
-    }
-    close FH;
-}
-
-print "\t", join("\t", sort keys %sams), "\n";
-foreach my $tax (sort keys %tax) {
-    print "$tax\t";
-    foreach my $sam (sort keys %sams) {
-	if (exists $tax{$tax}{$sam}) {
-	    print "$tax{$tax}{$sam}\t";
-	}
-	else {
-	    print "0.00\t";
-	}
-    }
-    print "\n";
-}
+# merged by the native program, which gives the same table
+exec("$Bin/taxmatrix", @ARGV) or die("Could not run $Bin/taxmatrix: $!\n");
 
 exit;
 
@@ -68,6 +39,9 @@ Usage:
 Options:
        <taxprof>      Taxonomy profile output from program taxprof
 
+       Same as: taxmatrix <taxprof 1> <taxprof 2> ...
+       See taxmatrix for sparse output and adding samples to a matrix.
+
 Contact:
         Have problems? Contact Bo Liu - boliu\@umiacs.umd.edu
 
@@ -0,0 +1,183 @@
+#!/usr/bin/perl
+
+#############################################
+#
+# Program: Simulate a metagenome with a known
+#          profile, run the whole pipeline on it
+#          with metaphyler.pl --timing, and score
+#          throughput and accuracy.
+#
+# Mon Oct 19 2026
+#
+#############################################
+
+use strict;
+use warnings;
+use FindBin qw($Bin);
+use Getopt::Long;
+use Time::HiRes;
+
+#----------------------------------------#
+# read command line options
+#----------------------------------------#
+my $nreads = 100000;
+my $length = 100;
+my $errate = 0;
+my $seed = 1;
+my $options = "";
+my $maxerror = -1;
+my $profile = "";
+my $blast = "";
+my $prefix = "";
+my $nump = 0;
+GetOptions("reads=i" => \$nreads, "length=i" => \$length, "error=f" => \$errate,
+	   "seed=i" => \$seed, "options=s" => \$options, "max-error=f" => \$maxerror) or Usage();
+if (scalar @ARGV == 4) {
+    ($profile, $blast, $prefix, $nump) = @ARGV;
+} else {
+    Usage();
+}
+#----------------------------------------#
+
+my $markers = "$Bin/../markers";
+my $taxonomy = "$markers/markers.taxonomy";
+my $tnames = "$markers/tid2name.tab";
+if (-e "$markers/markers.taxdb") {
+    $taxonomy = $tnames = "$markers/markers.taxdb";
+}
+
+# simulate reads, and write their true profile
+my $start = Time::HiRes::time();
+my $cmd = "$Bin/simuCommunity -n $nreads -l $length -e $errate -s $seed $markers/markers.dna $taxonomy $profile $prefix.truth $tnames > $prefix.fasta";
+print "$cmd\n";
+system("$cmd");
+die("Failed: $cmd\n") if ($? != 0);
+my $simtime = Time::HiRes::time() - $start;
+
+# run the pipeline, each step timed
+unlink("$prefix.timing");
+$start = Time::HiRes::time();
+$cmd = "perl $Bin/../metaphyler.pl --timing $options $prefix.fasta $blast $prefix $nump";
+print "$cmd\n";
+system("$cmd");
+my $failed = $? != 0;
+my $walltime = Time::HiRes::time() - $start;
+
+
+# time and memory of each step; steps run more than once (e.g., in shards)
+# are added up, with the largest peak memory
+my @steps = ();
+my %seconds = ();
+my %peak = ();
+my %runs = ();
+open(TIMING, "$prefix.timing") or die("Could not open file $prefix.timing\n");
+while (<TIMING>) {
+    chomp;
+    my ($step, $sec, $mem, $status) = split(/\t/);
+    push(@steps, $step) if (!exists $runs{$step});
+    ++$runs{$step};
+    $seconds{$step} += $sec;
+    $peak{$step} = $mem if (!exists $peak{$step} || $mem > $peak{$step});
+    $failed = 1 if ($status != 0);
+}
+close(TIMING);
+
+open(CARD, ">$prefix.scorecard") or die("Could not open file $prefix.scorecard\n");
+my $card = sprintf("%-20s%6s%12s%12s%12s\n", "Step", "Runs", "Seconds", "Reads/s", "Peak MB");
+$card .= sprintf("%-20s%6d%12.2f%12.0f%12s\n", "simuCommunity", 1, $simtime, $nreads / ($simtime || 1e-3), "-");
+foreach my $step (@steps) {
+    $card .= sprintf("%-20s%6d%12.2f%12.0f%12.1f\n", $step, $runs{$step}, $seconds{$step},
+		     $nreads / ($seconds{$step} || 1e-3), $peak{$step} / 1024);
+}
+$card .= sprintf("%-20s%6s%12.2f%12.0f%12s\n\n", "pipeline (wall)", "-", $walltime, $nreads / ($walltime || 1e-3), "-");
+
+
+# profile error at each level: half the sum of differences between true and
+# estimated abundances, both over named taxa only; assigned is the percent
+# of reads counted under a named taxon
+my $worst = 0;
+$card .= sprintf("%-20s%12s%12s\n", "Level", "Error %", "Assigned %");
+foreach my $level ("species", "genus", "family", "order", "class", "phylum") {
+    my %truth = readProfile("$prefix.truth.$level.taxprof");
+    next if (!%truth);
+    my %est = readProfile("$prefix.$level.taxprof");
+
+    my ($tsum, $esum) = (0, 0);
+    $tsum += $_ foreach (values %truth);
+    $esum += $_ foreach (values %est);
+    my %taxa = (%truth, %est);
+    my $error = 0;
+    foreach my $taxon (keys %taxa) {
+	my $t = exists $truth{$taxon} ? $truth{$taxon} / $tsum : 0;
+	my $e = exists $est{$taxon} && $esum > 0 ? $est{$taxon} / $esum : 0;
+	$error += abs($t - $e);
+    }
+    $error = $esum > 0 ? $error * 50 : 100;
+    $worst = $error if ($error > $worst);
+    $card .= sprintf("%-20s%12.2f%12.2f\n", $level, $error, $esum * 100 / $nreads);
+}
+print CARD $card;
+close(CARD);
+print "\n$card";
+
+die("Pipeline failed\n") if ($failed);
+if ($maxerror >= 0 && $worst > $maxerror) {
+    die("Profile error $worst% is above $maxerror%\n");
+}
+exit;
+
+
+# read counts of named taxa in a taxprof file
+sub readProfile {
+    my ($file) = @_;
+
+    my %counts = ();
+    open(PROF, $file) or return %counts;
+    <PROF>;
+    while (<PROF>) {
+	chomp;
+	my ($name, $percent, $count) = split(/\t/);
+	next if (!defined($count) || $name eq "Other");
+	$counts{$name} += $count;
+    }
+    close(PROF);
+    return %counts;
+}
+
+
+sub Usage {
+    die("
+Usage:
+       perl scorecard.pl [options] <profile> <blast> <prefix> <# threads>
+
+       Simulate reads from marker genes with a known profile, run metaphyler.pl
+       on them, and report the time, reads per second and peak memory of each
+       step (sampled, see --timing of metaphyler.pl), and the profile error at
+       each level.
+
+Options:
+       <profile>      Taxonomy label (of any level) and relative abundance on each line.
+       <blast>        blastn, blastx, both or cascade, as of metaphyler.pl.
+       <prefix>       Output prefix.
+       <# threads>    Number of threads, as of metaphyler.pl.
+       --reads <n>    Number of reads (default: 100000).
+       --length <n>   Read length (default: 100).
+       --error <rate> Substitution errors per base (default: 0).
+       --seed <n>     Random seed (default: 1).
+       --options <options>
+		      Options of metaphyler.pl, e.g., \"--prefilter --shards 8\".
+       --max-error <percent>
+		      Fail if the profile error at any level is above this.
+
+Output:
+       prefix.scorecard
+		      Time and memory of each step, and profile error at each level.
+
+       prefix.truth.<genus|family|order|class|phylum>.taxprof
+		      True profiles at each level.
+
+Contact:
+	Have problems? Contact Bo Liu - boliu\@umiacs.umd.edu
+
+");
+}
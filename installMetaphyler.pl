@@ -25,11 +25,27 @@ print "$cmd\n";
 system($cmd);
 
 my $gcc = "g++ -Wall -W -O2";
-my @programs = ("simuReads", "metaphylerClassify", "taxprof", "combine", "scores");
+
+# classification library, for metaphylerClassify and programs embedding it
+# (include src/metaphyler.h, link with bin/libmetaphyler.a -lrt)
+$cmd = "$gcc -c -o $Bin/bin/metaphyler.o $Bin/src/metaphyler.cpp && ar rcs $Bin/bin/libmetaphyler.a $Bin/bin/metaphyler.o && rm $Bin/bin/metaphyler.o";
+print "$cmd\n";
+system($cmd);
+
+my @programs = ("simuReads", "metaphylerClassify", "taxprof", "combine", "scores", "taxmatrix", "prefilter", "dedup", "taxdb", "quickprof", "kmerLCA", "simuCommunity", "collapseMarkers");
+my %libs = ("metaphylerClassify" => "$Bin/bin/libmetaphyler.a -lrt", "taxprof" => "-pthread", "taxmatrix" => "-pthread",
+	    "prefilter" => "-pthread", "quickprof" => "-pthread",
+	    "kmerLCA" => "-pthread");
 foreach my $program (@programs) {
-    $cmd = "$gcc -o $Bin/bin/$program $Bin/src/$program.cpp";
+    my $lib = exists $libs{$program} ? " $libs{$program}" : "";
+    $cmd = "$gcc -o $Bin/bin/$program $Bin/src/$program.cpp$lib";
     print "$cmd\n";
     system($cmd);
 }
 
+# compile taxonomy files into a database that all programs map
+$cmd = "$Bin/bin/taxdb $Bin/markers/markers.taxdb $Bin/markers/markers.taxonomy $Bin/markers/tid2name.tab";
+print "$cmd\n";
+system($cmd);
+
 exit;
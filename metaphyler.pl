@@ -13,6 +13,9 @@
 use strict;
 use warnings;
 use FindBin qw($Bin);
+use Getopt::Long;
+use POSIX qw(WNOHANG);
+use Time::HiRes;
 
 #----------------------------------------#
 # read command line options
@@ -21,50 +24,528 @@ my $query = "";
 my $blast = "";
 my $prefix = "";
 my $nump = 0;
+my $combine = "first";
+my $prefilter = 0;
+my $dedup = 0;
+my $batch = 0;
+my $tolerance = 1;
+my $levels = "";
+my $nshards = 0;
+my $resume = 0;
+my $quick = 0;
+my $lca = "";
+my $timing = 0;
+my $barcode = "";
+my $field = 1;
+my $cascadelevel = "genus";
+my $cascadeconf = 0.9;
+GetOptions("combine=s" => \$combine, "prefilter" => \$prefilter, "dedup" => \$dedup,
+	   "sample=i" => \$batch, "tolerance=f" => \$tolerance, "levels=s" => \$levels,
+	   "shards=i" => \$nshards, "resume" => \$resume,
+	   "quick" => \$quick, "lca=s" => \$lca,
+	   "timing" => \$timing, "barcode=s" => \$barcode, "field=i" => \$field,
+	   "cascade-level=s" => \$cascadelevel, "cascade-conf=f" => \$cascadeconf) or Usage();
 if (scalar @ARGV == 4) {
     ($query, $blast, $prefix, $nump) = @ARGV;
-    if ($blast ne "blastn" && $blast ne "blastx") { Usage();}
+    if ($blast ne "blastn" && $blast ne "blastx" && $blast ne "both" && $blast ne "cascade") { Usage();}
+    if ($combine ne "first" && $combine ne "best" && $combine ne "consensus") { Usage();}
+    if ($resume && $batch > 0) { Usage();}
+    if ($barcode ne "" && ($batch > 0 || $dedup || $quick)) { Usage();}
+    if (levelIndex($cascadelevel) < 0) { Usage();}
 } else {
     Usage();
 }
 #----------------------------------------#
 
 
-my $ref = "$Bin/markers/markers.dna";
-my $param = "-W15";
-if ($blast eq "blastx") {
-    $param = "";
-    $ref = "$Bin/markers/markers.protein";
+# compiled taxonomy database if installed, otherwise the text files
+my $taxonomy = "$Bin/markers/markers.taxonomy";
+my $tnames = "$Bin/markers/tid2name.tab";
+if (-e "$Bin/markers/markers.taxdb") {
+    $taxonomy = $tnames = "$Bin/markers/markers.taxdb";
 }
-# run blast
-my $cmd = "blastall -p $blast $param -a$nump -e0.01 -m8 -b1 -i $query -d $ref > $prefix.$blast";
-print "$cmd\n";
-system("$cmd");
 
-# classification
-$cmd = "$Bin/metaphylerClassify $Bin/markers/markers.$blast.classifier $Bin/markers/markers.taxonomy $prefix.$blast > $prefix.classification";
-print "$cmd\n";
-system("$cmd");
+my $taxprof = "$Bin/taxprof -t $nump -T $taxonomy";
+$taxprof .= " -s '$barcode' -k $field" if ($barcode ne "");
+my $cmd = "";
 
-$cmd = "$Bin/taxprof 0.9 $prefix.classification $prefix $Bin/markers/tid2name.tab";
-print "$cmd\n";
-system("$cmd");
+# with --timing, each step adds its time and memory to prefix.timing
+my $timingfile = "$prefix.timing";
+unlink($timingfile) if ($timing && !$resume);
+
+# rough profile from k-mers shared with markers, without BLAST
+if ($quick) {
+    my $xopt = $blast eq "blastx" ? " -x" : "";
+    my $ref = $blast eq "blastx" ? "$Bin/markers/markers.protein" : "$Bin/markers/markers.dna";
+    $cmd = "$Bin/quickprof$xopt -t $nump $ref $taxonomy $query $prefix $tnames";
+    exit(run($cmd) == 0 ? 0 : 1);
+}
+
+# shards share one copy of the models, as an image file next to the output;
+# it is written once here, before shards start, so that they all map it
+# instead of each loading the models while none is there yet
+my $model = "";
+if ($nshards > 0) {
+    $model = ($prefix =~ /\// ? "" : "./") . "$prefix.model";
+    unlink($model, "${model}_2");
+
+    my $joint = $blast eq "both" || $blast eq "cascade";
+    my $first = $joint ? "blastn" : $blast;
+    $cmd = "$Bin/metaphylerClassify -m $model -o /dev/null";
+    $cmd .= " -q /dev/null" if ($joint);
+    $cmd .= " $Bin/markers/markers.$first.classifier $taxonomy /dev/null";
+    $cmd .= " $Bin/markers/markers.blastx.classifier /dev/null" if ($joint);
+    run($cmd) == 0 or die("Could not load models: $cmd\n");
+}
+
+if ($batch == 0) {
+    classifyReads($query, $prefix) >= 0 or die("Classification failed, run again with --resume\n");
+# the classification keeps its marker, which taxprof -f waits for
+    unlink(grep { $_ ne "$prefix.classification.done" } glob("$prefix.*.done"));
+
+    $cmd = "$taxprof 0.9 $prefix.classification $prefix $tnames";
+    run($cmd);
+    unlink($model, "${model}_2") if ($model ne "");
+    exit;
+}
+
+# progressive sampling: classify random batches of reads, until
+# confidence intervals of the profile are within the tolerance
+my $nbatches = splitBatches($query, $prefix, $batch);
+unlink("$prefix.state");
+open(CLS, ">$prefix.classification") or die("Could not open file $prefix.classification\n");
+open(LOG, ">$prefix.sampling") or die("Could not open file $prefix.sampling\n");
+print LOG "batch\treads used\treads counted\tlargest CI half width\tstatus\n";
+my $nused = 0;
+for (my $i = 0; $i < $nbatches; ++$i) {
+    my $bprefix = "$prefix.batch$i";
+    my $nreads = classifyReads("$bprefix.fasta", $bprefix);
+    die("Classification of batch $i failed\n") if ($nreads < 0);
+    $nused += $nreads;
+
+    open(BCLS, "$bprefix.classification") or die("Could not open file $bprefix.classification\n");
+    print CLS while (<BCLS>);
+    close(BCLS);
+
+    $cmd = "$taxprof -r $prefix.state -e $tolerance";
+    $cmd .= " -l $levels" if ($levels ne "");
+    $cmd .= " 0.9 $bprefix.classification $prefix $tnames";
+    print "$cmd\n";
+    my $status = `$cmd`;
+    chomp($status);
+    my ($state, $ncounted, $width) = split(/\t/, $status);
+    print LOG "$i\t$nused\t$ncounted\t$width\t$state\n";
+    last if ($state eq "converged");
+}
+close(CLS);
+close(LOG);
+unlink(glob("$prefix.batch*"));
+unlink($model, "${model}_2") if ($model ne "");
 
 exit;
 
 
+# classify reads into prefix.classification, in shards if asked for
+# returns the number of reads
+sub classifyReads {
+    my ($query, $prefix) = @_;
+
+    return classify($query, $prefix, $nump) if ($nshards == 0);
+
+    unlink("$prefix.classification.done");
+    my @shards = splitShards($query, $prefix, $nshards);
+    my $nreads = 0;
+    $nreads += $_ foreach (@shards);
+
+# a pool of $nump workers, each takes the next shard once it is done with one;
+# a failed shard is tried once more
+    my @queue = (0 .. $#shards);
+    my %running = ();
+    my %tries = ();
+    while (@queue || %running) {
+	while (@queue && scalar(keys %running) < $nump) {
+	    my $i = shift(@queue);
+	    ++$tries{$i};
+	    my $pid = fork();
+	    die("Could not fork\n") if (!defined($pid));
+	    if ($pid == 0) {
+		exit(classify("$prefix.shard$i.fasta", "$prefix.shard$i", 1) < 0 ? 1 : 0);
+	    }
+	    $running{$pid} = $i;
+	}
+
+	my $pid = waitpid(-1, 0);
+	last if ($pid <= 0);
+	my $i = delete($running{$pid});
+	next if (!defined($i) || $? == 0);
+	die("Shard $i failed twice, run again with --resume\n") if ($tries{$i} > 1);
+	print STDERR "Shard $i failed, trying again\n";
+	push(@queue, $i);
+    }
+
+# merge outputs in shard order, so they are the same as of one run
+    my @programs = $blast eq "both" || $blast eq "cascade" ? ("blastn", "blastx") : ($blast);
+    foreach my $out ("classification", @programs) {
+	open(OUT, ">$prefix.$out") or die("Could not open file $prefix.$out\n");
+	for (my $i = 0; $i < @shards; ++$i) {
+	    open(SHARD, "$prefix.shard$i.$out") or die("Could not open file $prefix.shard$i.$out\n");
+	    print OUT while (<SHARD>);
+	    close(SHARD);
+	}
+	close(OUT);
+    }
+    unlink(glob("$prefix.shard*"));
+    open(DONE, ">$prefix.classification.done") or die("Could not open file $prefix.classification.done\n");
+    close(DONE);
+
+    return $nreads;
+}
+
+
+# split reads into consecutive shards of about the same number of reads;
+# shards are the same each time, so finished ones are kept with --resume
+# returns the number of reads in each shard
+sub splitShards {
+    my ($query, $prefix, $nshards) = @_;
+
+    my $nreads = `grep -c '^>' $query`;
+    chomp($nreads);
+    $nshards = $nreads if ($nshards > $nreads);
+    $nshards = 1 if ($nshards < 1);
+
+    my @sizes = ();
+    my $i = -1;
+    my $n = 0;
+    open(QUERY, $query) or die("Could not open file $query\n");
+    while (<QUERY>) {
+	if (/^>/ && ($i < 0 || $n >= $sizes[$i])) {
+	    close(SHARD) if ($i >= 0);
+	    ++$i;
+	    $sizes[$i] = int($nreads * ($i+1) / $nshards) - int($nreads * $i / $nshards);
+	    $n = 0;
+	    open(SHARD, ">$prefix.shard$i.fasta") or die("Could not open file $prefix.shard$i.fasta\n");
+	}
+	++$n if (/^>/);
+	print SHARD $_ if ($i >= 0);
+    }
+    close(SHARD) if ($i >= 0);
+    close(QUERY);
+
+    return @sizes;
+}
+
+
+# classify reads of a FASTA file into prefix.classification, with BLAST on $threads threads
+# returns the number of reads, -1 if a step failed
+sub classify {
+    my ($query, $prefix, $threads) = @_;
+
+    my $nreads = `grep -c '^>' $query`;
+    chomp($nreads);
+
+# identical reads are aligned once, and counted as many times as copies
+    if ($dedup) {
+	runStep("$Bin/dedup $query > $prefix.unique", "$prefix.unique") or return -1;
+	$query = "$prefix.unique";
+    }
+
+# reads whose k-mers all agree on a taxon are classified without BLAST,
+# the others are aligned and classified into prefix.aligned
+    my $output = "$prefix.classification";
+    if ($lca ne "") {
+	my $xopt = $blast eq "blastx" ? " -x" : "";
+	my $ref = $blast eq "blastx" ? "$Bin/markers/markers.protein" : "$Bin/markers/markers.dna";
+	runStep("$Bin/kmerLCA$xopt -l $lca -t $threads $ref $taxonomy $query $prefix.lca > $prefix.ambiguous",
+		"$prefix.ambiguous") or return -1;
+	$query = "$prefix.ambiguous";
+	$output = "$prefix.aligned";
+    }
+
+    my $joint = $blast eq "both" || $blast eq "cascade";
+    my @blasts = $joint ? ("blastn", "blastx") : ($blast);
+    my $input = $query;
+    foreach my $program (@blasts) {
+	my $ref = "$Bin/markers/markers.dna";
+	my $param = "-W15";
+	my $xopt = "";
+	if ($program eq "blastx") {
+	    $param = "";
+	    $ref = "$Bin/markers/markers.protein";
+	    $xopt = " -x";
+	}
+
+# in cascade mode, only reads blastn hits do not classify at the level go to blastx
+	$input = $query;
+	if ($blast eq "cascade" && $program eq "blastx") {
+	    my $nclsf = "$prefix.blastn.classification";
+	    runStep("$Bin/metaphylerClassify -c $combine -o $nclsf $Bin/markers/markers.blastn.classifier $taxonomy $prefix.blastn",
+		    $nclsf) or return -1;
+	    $input = "$prefix.unresolved";
+	    if (!($resume && -e "$input.done")) {
+		print "Reads not classified at $cascadelevel with confidence $cascadeconf: $input\n";
+		unresolved($query, $nclsf, $input) >= 0 or return -1;
+		open(DONE, ">$input.done") or die("Could not open file $input.done\n");
+		close(DONE);
+	    }
+	}
+
+# only reads sharing k-mers with markers go to blast
+	my $candidates = $input;
+	if ($prefilter) {
+	    $candidates = "$prefix.$program.candidates";
+	    runStep("$Bin/prefilter$xopt -t $threads $ref $input > $candidates", $candidates) or return -1;
+	}
+
+# run blast, keep more hits per read if they are combined
+	my $nhits = $combine eq "first" ? 1 : 10;
+	runStep("blastall -p $program $param -a$threads -e0.01 -m8 -b$nhits -i $candidates -d $ref > $prefix.$program",
+		"$prefix.$program") or return -1;
+    }
+
+# classification, blastn and blastx hits are classified together;
+# an interrupted classification continues from its last checkpoint
+    my $args = "$Bin/markers/markers.$blasts[0].classifier $taxonomy $prefix.$blasts[0]";
+    if ($joint) {
+	$args = "-q $query $args $Bin/markers/markers.blastx.classifier $prefix.blastx";
+    }
+    $args = "-m $model $args" if ($model ne "");
+    $args = "-o $output -k $prefix.checkpoint " . ($resume ? "-r " : "") . $args;
+    runStep("$Bin/metaphylerClassify -c $combine $args", $output) or return -1;
+    unlink("$prefix.checkpoint");
+
+    if ($lca ne "") {
+	runStep("cat $prefix.lca $prefix.aligned > $prefix.classification", "$prefix.classification") or return -1;
+    }
+
+    return $nreads;
+}
+
+
+# write reads of a FASTA file that are not classified at the cascade level
+# with enough confidence; classifications follow the order of reads, so
+# both files are read together
+# returns the number of reads written, -1 if a file could not be read
+sub unresolved {
+    my ($query, $clsfile, $outfile) = @_;
+
+    my $col = levelIndex($cascadelevel) + 1;
+    open(QUERY, $query) or return -1;
+    open(CLS, $clsfile) or return -1;
+    open(OUT, ">$outfile") or return -1;
+
+    my $cls = <CLS>;
+    my ($n, $keep) = (0, 0);
+    while (<QUERY>) {
+	if (/^>(\S+)/) {
+	    my $id = $1;
+	    $keep = 1;
+	    if (defined($cls) && $cls =~ /^(\S+)/ && $1 eq $id) {
+		my @labels = split(/\t/, $cls);
+		$keep = 0 if ($col < @labels && $labels[$col] =~ /^(.+)\(([\d.]+)\)/
+			      && $1 ne "NA" && $2 >= $cascadeconf);
+		$cls = <CLS>;
+	    }
+	    ++$n if ($keep);
+	}
+	print OUT $_ if ($keep);
+    }
+    close(OUT);
+    close(CLS);
+    close(QUERY);
+    return $n;
+}
+
+
+# index of a taxonomic level in classifications, lowest first; -1 if unknown
+sub levelIndex {
+    my ($level) = @_;
+
+    my @levels = ("species", "genus", "family", "order", "class", "phylum");
+    for (my $i = 0; $i < @levels; ++$i) {
+	return $i if ($levels[$i] eq $level);
+    }
+    return -1;
+}
+
+
+# run a command, unless --resume is given and it finished before,
+# i.e., its output has a .done file
+# returns 0 if it failed
+sub runStep {
+    my ($cmd, $output) = @_;
+
+    if ($resume && -e "$output.done") {
+	print "Done before: $cmd\n";
+	return 1;
+    }
+    unlink("$output.done");
+
+    return 0 if (run($cmd) != 0);
+
+    open(DONE, ">$output.done") or die("Could not open file $output.done\n");
+    close(DONE);
+    return 1;
+}
+
+
+# run a command, and return its exit status; with --timing, its wall time and
+# peak memory are added to prefix.timing. The memory of all its processes is
+# added up every 50 ms, and the largest sum is kept; processes that live
+# shorter than that may be missed.
+sub run {
+    my ($cmd) = @_;
+
+    print "$cmd\n";
+    if (!$timing) {
+	system("$cmd");
+	return $?;
+    }
+
+    my $start = Time::HiRes::time();
+    my $pid = fork();
+    die("Could not fork\n") if (!defined($pid));
+    if ($pid == 0) {
+	exec("/bin/sh", "-c", $cmd) or exit(127);
+    }
+
+    my $peak = 0;
+    my $status = 0;
+    for (;;) {
+	my $mem = memory($pid);
+	$peak = $mem if ($mem > $peak);
+	if (waitpid($pid, WNOHANG) == $pid) {
+	    $status = $?;
+	    last;
+	}
+	Time::HiRes::sleep(0.05);
+    }
+    my $seconds = Time::HiRes::time() - $start;
+
+# the step is named by its program
+    my ($step) = $cmd =~ /^(\S+)/;
+    $step =~ s/.*\///;
+    open(TIMING, ">>$timingfile") or die("Could not open file $timingfile\n");
+    printf TIMING "%s\t%.3f\t%d\t%d\n", $step, $seconds, $peak, $status;
+    close(TIMING);
+
+    return $status;
+}
+
+
+# resident memory in KB of a process and all processes under it, right now
+sub memory {
+    my ($pid) = @_;
+
+    my %children = ();
+    foreach my $stat (glob("/proc/[0-9]*/stat")) {
+	open(STAT, $stat) or next;
+	my $line = <STAT>;
+	close(STAT);
+	next if (!defined($line) || $line !~ /^(\d+) \(.*\) \S+ (\d+)/);
+	push(@{$children{$2}}, $1);
+    }
+
+    my $mem = 0;
+    my @pids = ($pid);
+    while (@pids) {
+	my $p = shift(@pids);
+	push(@pids, @{$children{$p}}) if (exists $children{$p});
+	open(STATUS, "/proc/$p/status") or next;
+	while (<STATUS>) {
+	    $mem += $1 if (/^VmRSS:\s+(\d+)/);
+	}
+	close(STATUS);
+    }
+    return $mem;
+}
+
+
+# put each read into one of about (# reads / batch size) batches at random
+# returns the number of batches
+sub splitBatches {
+    my ($query, $prefix, $batch) = @_;
+
+    my $nreads = `grep -c '^>' $query`;
+    chomp($nreads);
+    my $nbatches = int(($nreads + $batch - 1) / $batch);
+    $nbatches = 1 if ($nbatches < 1);
+
+    my @fhs = ();
+    for (my $i = 0; $i < $nbatches; ++$i) {
+	open($fhs[$i], ">$prefix.batch$i.fasta") or die("Could not open file $prefix.batch$i.fasta\n");
+    }
+
+    open(QUERY, $query) or die("Could not open file $query\n");
+    my $fh = $fhs[0];
+    while (<QUERY>) {
+	$fh = $fhs[int(rand($nbatches))] if (/^>/);
+	print $fh $_;
+    }
+    close(QUERY);
+    close($_) foreach (@fhs);
+
+    return $nbatches;
+}
+
+
 sub Usage {
     die("
 Usage:
-       perl runMetaphyler.pl <query> <blast> <prefix> <# threads>
+       perl runMetaphyler.pl [options] <query> <blast> <prefix> <# threads>
 
 Options:
        <query>        Query sequences in FASTA format to be classified.
-       <blast>        blastn or blastx.
-                      You can try both modes, and combine the classifications. 
+       <blast>        blastn, blastx, both or cascade.
+                      both runs blastn and blastx, and combines the classifications. 
+		      cascade runs blastn on all reads, but blastx only on reads
+		      it does not classify at --cascade-level, and combines them.
                       blastn is recommended for short reads (100bp).
        <prefix>       Output prefix.
        <# threads>    Number of threads to run BLAST.
+       --combine <mode>
+		      first, best or consensus (default: first).
+                      With best or consensus, BLAST keeps 10 hits per read,
+                      and they are combined by metaphylerClassify.
+       --prefilter    Only reads sharing k-mers with marker genes are sent to BLAST.
+       --dedup        Identical reads are aligned and classified once, and
+		      counted as many times as they occur.
+       --sample <batch size>
+		      Classify reads in random batches of about this size, and stop
+		      once the profile has converged (default: 0, all reads at once).
+       --tolerance <percent>
+		      With --sample, stop once the 95% confidence intervals of all
+		      taxa are within +/- this many percent (default: 1).
+       --levels <levels>
+		      Levels checked for convergence, e.g., phylum,class,genus
+		      (default: all).
+       --shards <n>   Split reads into n shards, and align and classify them in
+		      <# threads> processes at once, one BLAST thread each.
+		      A process takes the next shard once it is done with one,
+		      so use several shards per thread (default: 0, no shards).
+       --resume       Continue an interrupted run with the same options. Steps
+		      that finished are skipped, and classification continues
+		      from its last checkpoint. Not with --sample.
+       --lca <level>  Reads whose k-mers shared with marker genes all agree on one
+		      taxon at this level (e.g., genus) are classified without BLAST;
+		      only the other reads are aligned.
+       --timing       Add the wall time (seconds), peak memory (KB) and exit status
+		      of each step to prefix.timing, e.g., for scorecard.pl. Memory
+		      of all processes of a step is added up every 50 ms, so very
+		      short-lived processes may be missed.
+       --quick        Rough profile in seconds, from k-mers reads share with marker
+		      genes, without BLAST or classification. Taxprof files only;
+		      marker proteins are used for blastx, DNA otherwise.
+       --barcode <delimiters>
+		      Query pools reads of many samples, named by a field of the read
+		      ID split at any of these characters (e.g., _ for S01_read7).
+		      Reads are aligned and classified in one pass, and each sample
+		      gets its own profiles. Not with --sample, --dedup or --quick.
+       --field <n>    Field of the read ID naming the sample (default: 1).
+       --cascade-level <level>
+		      With cascade, reads go to blastx unless blastn hits classify
+		      them at this level (default: genus),
+       --cascade-conf <conf>
+		      with at least this confidence (default: 0.9).
 
 Output:
        prefix.blast[n/x]
@@ -73,9 +554,20 @@ Output:
        prefix.classification
                       Classification results.
 
+       prefix.classification.done
+                      Written once the classification is complete, e.g., for
+                      taxprof -f to stop following it.
+
        prefix.<genus|family|order|class|phylum>.taxprof
                       Taxonomy profiles at each level.
 
+       prefix.<sample>.<genus|family|order|class|phylum>.taxprof
+		      With --barcode, profiles of each sample.
+
+       prefix.sampling
+		      With --sample, reads used and the largest confidence interval
+		      after each batch.
+
 Contact:
         Have problems? Contact Bo Liu - boliu\@umiacs.umd.edu
 
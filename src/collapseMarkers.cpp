@@ -0,0 +1,414 @@
+// Collapse redundant marker genes: genes identical or nearly identical to
+// a longer one (e.g., copies in strains of a species) are dropped, and the
+// one kept stands for all of them, with their lowest common ancestor as its
+// lineage. A smaller database is faster to align to, and has fewer models.
+// Clusters are greedy: genes are visited from the longest, and each joins
+// the first kept gene it is near-identical to, or is kept itself.
+// Near-identical genes are found from sampled k-mers on a shared diagonal,
+// and compared without gaps.
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+
+#include <sstream>
+using std::istringstream;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <unordered_map>
+using std::unordered_map;
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+
+#include <unistd.h>
+
+#include "kmer.h"
+#include "taxdb.h"
+
+typedef vector<string>             VS;
+typedef vector<Uint>               VI;
+typedef map<string, Uint>          S2I;
+
+const Uint SAMPLE = 8;          // about one in this many k-mers is indexed
+const Uint NCHECK = 8;          // diagonals compared per gene, most shared k-mers first
+
+struct Cmdopts {
+  string dnafile,
+	 taxfile,
+	 prefix,
+	 protfile;       // written for the kept genes, if given
+  float  identity;
+  Uint   k;
+};
+
+struct Gene {
+  string id, seq;
+  Uint   lin;              // lineage, TAXDBNONE if the gene has none
+  Uint   rep;              // gene kept for it, itself if kept
+};
+
+// where a sampled k-mer occurs in a kept gene
+struct Occ {
+  Uint gene, pos;
+};
+
+typedef unordered_map<Kmer, vector<Occ> > K2O;
+
+// genes are visited from the longest, so a gene is kept before shorter copies
+struct LongerFirst {
+  const vector<Gene> &genes;
+  LongerFirst(const vector<Gene> &g) : genes(g) {}
+  bool operator()(Uint a, Uint b) const { return genes[a].seq.size() > genes[b].seq.size(); }
+};
+
+void helpmsg();
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
+void readGenes(string dnafile, const Taxonomy &tax, const VI &gene2lin, vector<Gene> &genes);
+void sampledKmers(const string &seq, Uint k, vector<Kmer> &kmers, vector<Uint> &poss);
+Uint findRep(const Cmdopts &cmdopts, const vector<Gene> &genes, const K2O &index, Uint g);
+bool nearIdentical(const string &seq1, const string &seq2, int diag, float identity);
+void collapse(const Cmdopts &cmdopts, vector<Gene> &genes, Uint &nexact, Uint &nnear);
+VS   lcaLineage(const vector<VS> &lineages, const vector<Uint> &lins);
+void writeOutput(const Cmdopts &cmdopts, const vector<Gene> &genes, const vector<VS> &lineages);
+
+
+int main(int argc, char *argv[]) {
+
+  // read in command line options
+  Cmdopts cmdopts;
+  getcmdopts(argc, argv, cmdopts);
+
+
+  Taxonomy   tax;
+  VI         gene2lin;
+  vector<VS> lineages;
+  string     err;
+  if (!readLineages(cmdopts.taxfile, tax, gene2lin, lineages, err)) {
+    cerr << err << endl;
+    exit(1);
+  }
+
+  vector<Gene> genes;
+  readGenes(cmdopts.dnafile, tax, gene2lin, genes);
+
+
+  Uint nexact = 0, nnear = 0;
+  collapse(cmdopts, genes, nexact, nnear);
+
+  writeOutput(cmdopts, genes, lineages);
+
+  cout << "Genes: " << genes.size() << "\tkept: " << genes.size() - nexact - nnear
+       << "\tidentical: " << nexact << "\tnear-identical: " << nnear << endl;
+
+  return 0;
+}
+
+
+// marker genes in file order, sequences in upper case
+void readGenes(string dnafile, const Taxonomy &tax, const VI &gene2lin, vector<Gene> &genes) {
+
+  ifstream ifs(dnafile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << dnafile << endl;
+    exit(1);
+  }
+
+  SeqReader reader(ifs);
+  SeqRecord rec;
+  while (reader.next(rec)) {
+    Gene gene;
+    gene.id  = seqID(rec.header);
+    gene.seq = rec.seq;
+    for (size_t i = 0; i < gene.seq.size(); ++i)
+      gene.seq[i] = toupper(gene.seq[i]);
+    int gnum = tax.findGene(gene.id.c_str());
+    gene.lin = gnum < 0 ? TAXDBNONE : gene2lin[gnum];
+    gene.rep = genes.size();
+    genes.push_back(gene);
+  }
+}
+
+
+// forward k-mers (genes are on their coding strand) whose hash falls in
+// the sample, and their positions; k <= 31
+void sampledKmers(const string &seq, Uint k, vector<Kmer> &kmers, vector<Uint> &poss) {
+
+  kmers.clear();
+  poss.clear();
+  Kmer mask = (((Kmer) 1) << (2*k)) - 1, fwd = 0;
+  Uint len  = 0;
+  for (size_t i = 0; i < seq.size(); ++i) {
+    Uint c = baseCode(seq[i]);
+    if (c > 3) { len = 0; fwd = 0; continue; }
+    fwd = ((fwd << 2) | c) & mask;
+    if (++len >= k && hashKmer(fwd) % SAMPLE == 0) {
+      kmers.push_back(fwd);
+      poss.push_back(i + 1 - k);
+    }
+  }
+}
+
+
+// if two sequences, with positions in seq2 diag more than in seq1, have at
+// least this identity over the longer of them, counting substitutions only
+bool nearIdentical(const string &seq1, const string &seq2, int diag, float identity) {
+
+  size_t longer = std::max(seq1.size(), seq2.size());
+  size_t maxdiff = (size_t) ((1 - identity) * longer);
+
+  // bases outside the overlap count as differences
+  size_t beg1 = diag < 0 ? -diag : 0, beg2 = diag > 0 ? diag : 0;
+  if (beg1 >= seq1.size() || beg2 >= seq2.size()) return false;
+  size_t overlap = std::min(seq1.size() - beg1, seq2.size() - beg2);
+  if (longer - overlap > maxdiff) return false;
+
+  size_t ndiff = longer - overlap;
+  for (size_t i = 0; i < overlap; ++i)
+    if (seq1[beg1+i] != seq2[beg2+i] && ++ndiff > maxdiff)
+      return false;
+  return true;
+}
+
+
+// first kept gene gene g is near-identical to, by how many sampled k-mers
+// they share on one diagonal; TAXDBNONE if there is none
+Uint findRep(const Cmdopts &cmdopts, const vector<Gene> &genes, const K2O &index, Uint g) {
+
+  vector<Kmer> kmers;
+  vector<Uint> poss;
+  sampledKmers(genes[g].seq, cmdopts.k, kmers, poss);
+
+  // votes of (kept gene, diagonal)
+  unordered_map<uint64_t, Uint> votes;
+  for (size_t i = 0; i < kmers.size(); ++i) {
+    K2O::const_iterator citer = index.find(kmers[i]);
+    if (citer == index.end()) continue;
+    for (vector<Occ>::const_iterator oiter = citer->second.begin(); oiter != citer->second.end(); ++oiter)
+      ++votes[(uint64_t) oiter->gene << 32 | (Uint) ((int) poss[i] - (int) oiter->pos)];
+  }
+
+  vector<std::pair<Uint, uint64_t> > cands;
+  for (unordered_map<uint64_t, Uint>::const_iterator citer = votes.begin(); citer != votes.end(); ++citer)
+    cands.push_back(std::make_pair(citer->second, citer->first));
+  std::sort(cands.begin(), cands.end(), std::greater<std::pair<Uint, uint64_t> >());
+
+  for (size_t c = 0; c < cands.size() && c < NCHECK; ++c) {
+    Uint rep  = cands[c].second >> 32;
+    int  diag = (int) (Uint) cands[c].second;
+    if (nearIdentical(genes[rep].seq, genes[g].seq, diag, cmdopts.identity))
+      return rep;
+  }
+  return TAXDBNONE;
+}
+
+
+// assign every gene to the gene kept for it
+// genes without a lineage are kept as they are, they are not classified anyway
+void collapse(const Cmdopts &cmdopts, vector<Gene> &genes, Uint &nexact, Uint &nnear) {
+
+  vector<Uint> order(genes.size());
+  for (Uint g = 0; g < genes.size(); ++g) order[g] = g;
+  std::stable_sort(order.begin(), order.end(), LongerFirst(genes));
+
+  unordered_map<string, Uint> seq2rep;   // identical genes, without a k-mer lookup
+  K2O          index;                    // sampled k-mers of kept genes
+  vector<Kmer> kmers;
+  vector<Uint> poss;
+  for (vector<Uint>::const_iterator citer = order.begin(); citer != order.end(); ++citer) {
+    Uint g = *citer;
+    if (genes[g].lin == TAXDBNONE) continue;
+
+    unordered_map<string, Uint>::const_iterator siter = seq2rep.find(genes[g].seq);
+    if (siter != seq2rep.end()) {
+      genes[g].rep = siter->second;
+      ++nexact;
+      continue;
+    }
+
+    if (cmdopts.identity < 1) {
+      Uint rep = findRep(cmdopts, genes, index, g);
+      if (rep != TAXDBNONE) {
+	genes[g].rep = rep;
+	++nnear;
+	continue;
+      }
+    }
+
+    // kept
+    seq2rep.insert(unordered_map<string, Uint>::value_type(genes[g].seq, g));
+    if (cmdopts.identity < 1) {
+      sampledKmers(genes[g].seq, cmdopts.k, kmers, poss);
+      for (size_t i = 0; i < kmers.size(); ++i) {
+	Occ occ = {g, poss[i]};
+	index[kmers[i]].push_back(occ);
+      }
+    }
+  }
+}
+
+
+// lowest common ancestor of lineages: labels all of them agree on, from the
+// top down to the first level they differ at; NA below it
+VS lcaLineage(const vector<VS> &lineages, const vector<Uint> &lins) {
+
+  Uint nlevs = 0;
+  for (Uint i = 0; i < lins.size(); ++i)
+    nlevs = std::max(nlevs, (Uint) lineages[lins[i]].size());
+
+  VS lca(nlevs, "NA");
+  for (Uint lev = nlevs; lev-- > 0; ) {
+    const string *label = NULL;
+    bool agree = true, differ = false;
+    for (Uint i = 0; i < lins.size(); ++i) {
+      const VS &labs = lineages[lins[i]];
+      if (lev >= labs.size() || labs[lev] == "NA")
+	agree = false;
+      else if (label == NULL)
+	label = &labs[lev];
+      else if (*label != labs[lev])
+	agree = false, differ = true;
+    }
+    if (differ) break;
+    if (agree) lca[lev] = *label;
+  }
+  return lca;
+}
+
+
+// kept genes, with their LCA lineages, and which gene each gene is kept as
+void writeOutput(const Cmdopts &cmdopts, const vector<Gene> &genes, const vector<VS> &lineages) {
+
+  vector<vector<Uint> > members(genes.size());
+  for (Uint g = 0; g < genes.size(); ++g)
+    if (genes[g].lin != TAXDBNONE)
+      members[genes[g].rep].push_back(genes[g].lin);
+
+  string dnafn = cmdopts.prefix + ".dna", taxfn = cmdopts.prefix + ".taxonomy", mapfn = cmdopts.prefix + ".map";
+  ofstream dna(dnafn.c_str()), tax(taxfn.c_str()), mapping(mapfn.c_str());
+  if (!dna || !tax || !mapping) {
+    cerr << "Could not open file " << (!dna ? dnafn : !tax ? taxfn : mapfn) << endl;
+    exit(1);
+  }
+
+  for (Uint g = 0; g < genes.size(); ++g) {
+    mapping << genes[g].id << "\t" << genes[genes[g].rep].id << "\n";
+    if (genes[g].rep != g) continue;
+
+    dna << ">" << genes[g].id << "\n" << genes[g].seq << "\n";
+    if (genes[g].lin == TAXDBNONE) continue;
+
+    VS lca = lcaLineage(lineages, members[g]);
+    tax << genes[g].id << "\t";
+    for (VS::const_iterator citer = lca.begin(); citer != lca.end(); ++citer)
+      tax << *citer << "\t";
+    tax << "\n";
+  }
+
+  // proteins of kept genes, by ID
+  if (cmdopts.protfile == "") return;
+
+  ifstream ifs(cmdopts.protfile.c_str());
+  string protfn = cmdopts.prefix + ".protein";
+  ofstream prot(protfn.c_str());
+  if (!ifs || !prot) {
+    cerr << "Could not open file " << (!ifs ? cmdopts.protfile : protfn) << endl;
+    exit(1);
+  }
+
+  S2I id2gene;
+  for (Uint g = 0; g < genes.size(); ++g)
+    id2gene[genes[g].id] = g;
+
+  SeqReader reader(ifs);
+  SeqRecord rec;
+  while (reader.next(rec)) {
+    S2I::const_iterator citer = id2gene.find(seqID(rec.header));
+    if (citer == id2gene.end() || genes[citer->second].rep == citer->second)
+      prot << ">" << seqID(rec.header) << "\n" << rec.seq << "\n";
+  }
+}
+
+
+// parse command line options
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
+
+  cmdopts.identity = 0.99;
+  cmdopts.k        = 16;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:k:")) != -1) {
+    switch (opt) {
+    case 'i': cmdopts.identity = atof(optarg); break;
+    case 'k': cmdopts.k        = atoi(optarg); break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+
+  if ((argc - optind != 3 && argc - optind != 4) || cmdopts.identity <= 0 || cmdopts.identity > 1
+      || cmdopts.k == 0 || cmdopts.k > 31) {
+    helpmsg();
+    exit(1);
+  }
+  cmdopts.dnafile  = argv[optind];
+  cmdopts.taxfile  = argv[optind+1];
+  cmdopts.prefix   = argv[optind+2];
+  cmdopts.protfile = argc - optind == 4 ? argv[optind+3] : "";
+
+  // output would replace the input before it is read
+  const string &prefix = cmdopts.prefix;
+  if (prefix + ".dna" == cmdopts.dnafile || prefix + ".taxonomy" == cmdopts.taxfile
+      || prefix + ".protein" == cmdopts.protfile) {
+    cerr << "Output prefix " << prefix << " would overwrite the input files" << endl;
+    exit(1);
+  }
+}
+
+
+// print out usage help message
+void helpmsg() {
+  cerr << endl;
+
+  cerr << "Usage:" << endl;
+  cerr << "        ./collapseMarkers [options] <markers.dna> <taxonomy> <prefix> [<markers.protein>]" << endl;
+  cerr << endl;
+  cerr << "        Keep one of each group of identical or near-identical marker genes," << endl;
+  cerr << "        labeled with the lowest common ancestor of the group." << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "        <markers.dna>    Marker genes in FASTA format, on their coding strand." << endl << endl;
+  cerr << "        <taxonomy>       Taxonomy labels of marker genes (e.g., markers.taxonomy)," << endl;
+  cerr << "                         or a database compiled by taxdb." << endl << endl;
+  cerr << "        <prefix>         Output prefix." << endl << endl;
+  cerr << "        <markers.protein> Proteins of the marker genes, by the same IDs." << endl << endl;
+  cerr << "        -i <identity>    Genes with at least this identity to a longer kept gene, over" << endl;
+  cerr << "                         its whole length and without gaps, are collapsed into it" << endl;
+  cerr << "                         (default: 0.99; 1 for identical genes only)." << endl << endl;
+  cerr << "        -k <k>           Length of k-mers near-identical genes are found by (default: 16)." << endl << endl;
+
+  cerr << "Output files:" << endl;
+  cerr << "        prefix.dna, prefix.protein" << endl;
+  cerr << "                         Kept genes (and their proteins), to align to and train models on." << endl;
+  cerr << "        prefix.taxonomy  Their lineages, the lowest common ancestor of the genes each stands for." << endl;
+  cerr << "        prefix.map       Every gene, and the gene kept for it." << endl << endl;
+
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
+}
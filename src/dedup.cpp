@@ -0,0 +1,220 @@
+// Collapse identical reads into one, so that each distinct sequence is
+// aligned and classified once; the number of copies is kept in the read ID
+// as ";size=N", and taxprof counts the read N times
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <unordered_map>
+using std::unordered_map;
+
+#include <functional>
+using std::hash;
+
+#include <cstdlib>
+#include <cctype>
+
+#include <unistd.h>
+
+#include "kmer.h"
+
+typedef unordered_map<size_t, Uint> H2I;
+
+const Uint NOREC = ~0U;
+
+struct Cmdopts {
+  string queryfile;
+  bool   revcomp;        // a read and its reverse complement are duplicates
+  Uint   minsize;        // drop sequences with fewer copies
+};
+
+void helpmsg();
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
+char complement(char base);
+void seqKey(const string &seq, bool userc, string &key, string &rc, bool &flip);
+bool sameKey(const string &key, const string &seq, bool flip);
+
+
+int main(int argc, char *argv[]) {
+
+  // read in command line options
+  Cmdopts cmdopts;
+  getcmdopts(argc, argv, cmdopts);
+
+  ifstream ifs(cmdopts.queryfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.queryfile << endl;
+    exit(1);
+  }
+
+
+  // first copy of each distinct sequence, and its number of copies;
+  // sequences are found by the hash of their key, and records with the
+  // same hash are chained and compared, so no key is kept
+  vector<SeqRecord> recs;
+  vector<Uint>      sizes;
+  vector<Uint>      nextrec; // next record with the same hash
+  vector<bool>      flipped; // key of the record is its reverse complement
+  H2I               hash2rec;
+  SeqReader reader(ifs);
+  SeqRecord rec;
+  string    key, rc;
+  bool      flip;
+  uint64_t  nreads = 0;
+  while (reader.next(rec)) {
+    ++nreads;
+    seqKey(rec.seq, cmdopts.revcomp, key, rc, flip);
+
+    std::pair<H2I::iterator, bool> ins = hash2rec.insert(H2I::value_type(hash<string>()(key), recs.size()));
+    Uint i = ins.second ? NOREC : ins.first->second;
+    while (i != NOREC && !sameKey(key, recs[i].seq, flipped[i]))
+      i = nextrec[i];
+    if (i != NOREC) {
+      ++sizes[i];
+      continue;
+    }
+
+    if (!ins.second) {     // a new sequence heads the chain of its hash
+      nextrec.push_back(ins.first->second);
+      ins.first->second = recs.size();
+    }
+    else
+      nextrec.push_back(NOREC);
+    recs.push_back(rec);
+    sizes.push_back(1);
+    flipped.push_back(flip);
+  }
+
+
+  // print out distinct sequences in the order they first appear
+  uint64_t nuniq = 0;
+  for (Uint i = 0; i < recs.size(); ++i) {
+    if (sizes[i] < cmdopts.minsize) continue;
+    ++nuniq;
+
+    const SeqRecord &r = recs[i];
+    cout << r.header[0] << seqID(r.header) << ";size=" << sizes[i] << "\n" << r.seq << "\n";
+    if (r.header[0] == '@')
+      cout << "+\n" << r.qual << "\n";
+  }
+
+  cerr << nreads << " reads, " << recs.size() << " distinct sequences";
+  if (cmdopts.minsize > 1)
+    cerr << ", " << nuniq << " with at least " << cmdopts.minsize << " copies";
+  cerr << endl;
+
+  return 0;
+}
+
+
+// complement of an upper case base, ambiguity codes included; other
+// characters are their own, so no two sequences get the same key
+char complement(char base) {
+
+  switch (base) {
+  case 'A': return 'T';
+  case 'C': return 'G';
+  case 'G': return 'C';
+  case 'T': return 'A';
+  case 'R': return 'Y';
+  case 'Y': return 'R';
+  case 'K': return 'M';
+  case 'M': return 'K';
+  case 'B': return 'V';
+  case 'V': return 'B';
+  case 'D': return 'H';
+  case 'H': return 'D';
+  default:  return base;   // S, W, N and others
+  }
+}
+
+
+// sequence in upper case, or its reverse complement if that comes first
+// and they are duplicates (flip)
+void seqKey(const string &seq, bool userc, string &key, string &rc, bool &flip) {
+
+  key.resize(seq.size());
+  for (size_t i = 0; i < seq.size(); ++i)
+    key[i] = toupper(seq[i]);
+
+  flip = false;
+  if (userc) {
+    rc.resize(key.size());
+    for (size_t i = 0; i < key.size(); ++i)
+      rc[i] = complement(key[key.size()-1-i]);
+    if (rc < key) {
+      key.swap(rc);
+      flip = true;
+    }
+  }
+}
+
+
+// whether a sequence has this key, without building its key
+bool sameKey(const string &key, const string &seq, bool flip) {
+
+  if (key.size() != seq.size()) return false;
+  size_t n = seq.size();
+  for (size_t i = 0; i < n; ++i) {
+    char c = flip ? complement(toupper(seq[n-1-i])) : toupper(seq[i]);
+    if (c != key[i]) return false;
+  }
+  return true;
+}
+
+
+// parse command line options
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
+
+  cmdopts.revcomp = false;
+  cmdopts.minsize = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "rm:")) != -1) {
+    switch (opt) {
+    case 'r': cmdopts.revcomp = true; break;
+    case 'm': cmdopts.minsize = atoi(optarg); break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+
+  if (argc - optind != 1) {
+    helpmsg();
+    exit(1);
+  }
+  cmdopts.queryfile = argv[optind];
+}
+
+
+// print out usage help message
+void helpmsg() {
+  cerr << endl;
+
+  cerr << "Usage:" << endl;
+  cerr << "        ./dedup [options] <query>" << endl;
+  cerr << endl;
+  cerr << "        Print out each distinct read sequence once, with its number of" << endl;
+  cerr << "        copies appended to the read ID (e.g., read1;size=12). Upper and" << endl;
+  cerr << "        lower case bases are the same." << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "        <query>      Reads in FASTA or FASTQ format." << endl << endl;
+  cerr << "        -r           A read and its reverse complement are duplicates." << endl << endl;
+  cerr << "        -m <size>    Drop sequences with fewer copies (default: 1)." << endl << endl;
+
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
+}
@@ -0,0 +1,357 @@
+// hits of reads to reference genes: BLAST -m8, SAM/BAM or PAF records are
+// all turned into BLAST -m8 lines; for SAM and PAF, % identity and alignment
+// length come from the CIGAR string and the NM tag, and the bit score is
+// recomputed with the blastn scores the classifier models are trained with
+
+#ifndef HITS_H
+#define HITS_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+enum HitFormat { M8, SAM, BAM, PAF };
+
+// blastall -p blastn defaults, and the Karlin-Altschul parameters blastall
+// reports for them: those of reward 1, penalty 3, which it uses for gapped
+// alignments too (e.g., 198 bits for 100 identical bases)
+const int    NREWARD  = 1;
+const int    NPENALTY = 3;
+const int    NGAPOPEN = 5;
+const int    NGAPEXT  = 2;
+const double NLAMBDA  = 1.374;
+const double NKAPPA   = 0.711;
+
+
+// format from the file name: .sam, .bam, .paf, otherwise BLAST -m8
+inline HitFormat hitFormat(const std::string &file) {
+
+  size_t pos = file.rfind('.');
+  std::string ext = pos == std::string::npos ? "" : file.substr(pos+1);
+  if (ext == "sam") return SAM;
+  if (ext == "bam") return BAM;
+  if (ext == "paf") return PAF;
+  return M8;
+}
+
+// format by name, e.g., from the command line; false if unknown
+inline bool hitFormat(const std::string &name, HitFormat &format) {
+
+  if      (name == "m8")  format = M8;
+  else if (name == "sam") format = SAM;
+  else if (name == "bam") format = BAM;
+  else if (name == "paf") format = PAF;
+  else return false;
+  return true;
+}
+
+
+// bit score of column 12 of a BLAST -m8 line,
+// which sometimes has an extra space before it
+inline unsigned m8Bits(const std::string &line) {
+
+  size_t pos = 0;
+  for (int i = 0; i < 11; ++i) {
+    pos = line.find('\t', i == 0 ? 0 : pos+1);
+    if (pos == std::string::npos) return 0;
+  }
+  return (unsigned) atof(line.c_str() + pos + 1);
+}
+
+
+// columns of an alignment, as BLAST counts them
+struct AlnStats {
+  unsigned len,            // aligned columns, including gaps
+	   matches,
+	   mismatches,
+	   gapopens,
+	   gaps;           // gap columns
+};
+
+// count aligned bases and gaps of a CIGAR string, mismatches from the NM
+// tag (edit distance) or from X operations; clipping and skips are not aligned
+inline bool cigarStats(const char *cigar, int nm, AlnStats &aln) {
+
+  unsigned aligned = 0, diffs = 0;
+  aln.gapopens = aln.gaps = 0;
+  for (const char *p = cigar; *p && *p != '\t'; ) {
+    char *end;
+    unsigned n = strtoul(p, &end, 10);
+    if (end == p) return false;
+    switch (*end) {
+    case 'M': case '=': aligned += n; break;
+    case 'X':           aligned += n; diffs += n; break;
+    case 'I': case 'D': ++aln.gapopens; aln.gaps += n; break;
+    case 'S': case 'H': case 'N': case 'P': break;
+    default:  return false;
+    }
+    p = end + 1;
+  }
+  if (aligned == 0) return false;
+
+  if (nm >= 0)
+    diffs = (unsigned) nm > aln.gaps ? nm - aln.gaps : 0;
+  aln.mismatches = diffs < aligned ? diffs : aligned;
+  aln.matches    = aligned - aln.mismatches;
+  aln.len        = aligned + aln.gaps;
+  return true;
+}
+
+// blastn bit score of an alignment, with decimals, e.g., for its E-value
+inline double exactBits(const AlnStats &aln) {
+
+  double raw = (double) NREWARD*aln.matches - (double) NPENALTY*aln.mismatches
+	       - (double) NGAPOPEN*aln.gapopens - (double) NGAPEXT*aln.gaps;
+  return (NLAMBDA*raw - log(NKAPPA)) / log(2.0);
+}
+
+// blastn bit score of an alignment, without decimals as blastall prints it
+inline unsigned bitScore(const AlnStats &aln) {
+
+  double bit = exactBits(aln);
+  return bit > 0 ? (unsigned) bit : 0;
+}
+
+// BLAST -m8 line of an alignment; columns not used are 0
+inline void m8Line(const std::string &qid, const std::string &rid, const AlnStats &aln, std::string &line) {
+
+  char cols[128];
+  snprintf(cols, sizeof(cols), "\t%.2f\t%u\t%u\t%u\t0\t0\t0\t0\t0\t%u",
+	   aln.len ? 100.0*aln.matches/aln.len : 0.0, aln.len, aln.mismatches, aln.gapopens, bitScore(aln));
+  line = qid + "\t" + rid + cols;
+}
+
+
+// value of an integer tag, e.g., "NM:i:", among tab separated tags; -1 if absent
+inline int intTag(const std::vector<const char *> &fields, size_t first, const char *tag) {
+
+  for (size_t i = first; i < fields.size(); ++i)
+    if (strncmp(fields[i], tag, 5) == 0)
+      return atoi(fields[i] + 5);
+  return -1;
+}
+
+// split a line at tabs, without copying
+inline void splitTabs(const std::string &line, std::vector<const char *> &fields) {
+
+  fields.clear();
+  const char *p = line.c_str();
+  fields.push_back(p);
+  for (; *p; ++p)
+    if (*p == '\t') fields.push_back(p+1);
+}
+
+// field up to the next tab
+inline std::string field(const char *p) {
+  return std::string(p, strcspn(p, "\t"));
+}
+
+
+// a mapped SAM record as a BLAST -m8 line; mates of a pair get their suffix
+// back (e.g., /1 and /2), as they have in BLAST output
+// returns false for headers and unmapped reads
+inline bool samToM8(const std::string &raw, const std::vector<std::string> &matesfx, std::string &line) {
+
+  if (raw.empty() || raw[0] == '@') return false;
+
+  std::vector<const char *> fields;
+  splitTabs(raw, fields);
+  if (fields.size() < 11) return false;
+
+  int flag = atoi(fields[1]);
+  if ((flag & 4) || fields[2][0] == '*') return false;
+
+  AlnStats aln;
+  if (!cigarStats(fields[5], intTag(fields, 11, "NM:i:"), aln)) return false;
+
+  std::string qid = field(fields[0]);
+  if ((flag & 1) && matesfx.size() == 2 && (flag & 0xc0))
+    qid += matesfx[(flag & 0x40) ? 0 : 1];
+  m8Line(qid, field(fields[2]), aln, line);
+  return true;
+}
+
+// a PAF record as a BLAST -m8 line; without a cg tag, unmatched columns are
+// taken as mismatches
+inline bool pafToM8(const std::string &raw, std::string &line) {
+
+  std::vector<const char *> fields;
+  splitTabs(raw, fields);
+  if (fields.size() < 12) return false;
+
+  AlnStats aln;
+  int nm = intTag(fields, 12, "NM:i:");
+  bool cigar = false;
+  for (size_t i = 12; i < fields.size() && !cigar; ++i)
+    if (strncmp(fields[i], "cg:Z:", 5) == 0)
+      cigar = cigarStats(fields[i] + 5, nm, aln);
+
+  if (!cigar) {
+    aln.len        = atoi(fields[10]);
+    aln.matches    = atoi(fields[9]);
+    aln.mismatches = aln.len > aln.matches ? aln.len - aln.matches : 0;
+    aln.gapopens   = aln.gaps = 0;
+  }
+  if (aln.len == 0) return false;
+
+  m8Line(field(fields[0]), field(fields[5]), aln, line);
+  return true;
+}
+
+
+// a SAM header line saying records are sorted by coordinate, so hits of a
+// read are not next to each other
+inline bool coordSorted(const std::string &hd) {
+
+  return hd.compare(0, 4, "@HD\t") == 0 && hd.find("\tSO:coordinate") != std::string::npos;
+}
+
+
+// run a program without a shell, and read its standard output;
+// NULL if it could not be started
+inline FILE *spawn(const char *const argv[], pid_t &pid) {
+
+  int fds[2];
+  if (::pipe(fds) != 0) return NULL;
+  pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+  }
+  if (pid == 0) {
+    dup2(fds[1], 1);
+    close(fds[0]);
+    close(fds[1]);
+    execvp(argv[0], (char *const *) argv);
+    perror(argv[0]);
+    _exit(127);
+  }
+  close(fds[1]);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);  // not inherited by programs run later
+  return fdopen(fds[0], "r");
+}
+
+// close the output of a program run by spawn; true if it exited with 0
+inline bool reap(FILE *out, pid_t pid) {
+
+  fclose(out);
+  int status;
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR) return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+// reads hits one at a time as BLAST -m8 lines, from a file,
+// or from samtools view for BAM
+struct HitFile {
+  std::string name;
+  HitFormat   format;
+  std::ifstream ifs;
+  FILE        *pipe;
+  pid_t       child;       // samtools view, for BAM
+  off_t       pos;         // offset of the next record in the file, not for BAM
+  bool        bycoord;     // SAM/BAM header says sorted by coordinate
+  bool        failed;      // the file could not be read to its end
+  const std::vector<std::string> *matesfx;
+  std::string raw;
+
+  HitFile() : format(M8), pipe(NULL), child(0), pos(0), bycoord(false), failed(false), matesfx(NULL) {}
+  ~HitFile() { if (pipe) reap(pipe, child); }
+
+  bool open(const std::string &file, HitFormat fmt, const std::vector<std::string> &sfx) {
+    name    = file;
+    format  = fmt;
+    matesfx = &sfx;
+    pos     = 0;
+    bycoord = failed = false;
+    if (format == BAM) {
+      // the header is read on its own, records come without it; samtools
+      // failing (e.g., not installed, or not a BAM file) fails the open
+      const char *hargv[] = {"samtools", "view", "-H", file.c_str(), NULL};
+      FILE *hdr = spawn(hargv, child);
+      if (hdr == NULL) return false;
+      char buf[4096];
+      if (fgets(buf, sizeof(buf), hdr))
+	bycoord = coordSorted(buf);
+      while (fgets(buf, sizeof(buf), hdr))
+	;                  // the rest, so that samtools finishes
+      if (!reap(hdr, child)) return false;
+
+      const char *argv[] = {"samtools", "view", file.c_str(), NULL};
+      pipe = spawn(argv, child);
+      return pipe != NULL;
+    }
+    ifs.open(file.c_str());
+    if (!ifs) return false;
+    if (format == SAM) {
+      std::string hd;
+      if (getline(ifs, hd))
+	bycoord = coordSorted(hd);
+      ifs.clear();
+      ifs.seekg(0);
+    }
+    return ifs ? true : false;
+  }
+
+  // continue at an offset given by pos before
+  bool seek(off_t off) {
+    if (format == BAM) return false;
+    ifs.clear();
+    ifs.seekg(off);
+    pos = off;
+    return ifs ? true : false;
+  }
+
+  // next hit; linepos is the offset of its record
+  bool next(std::string &line, off_t &linepos) {
+    std::string &rec = format == M8 ? line : raw;
+    for (;;) {
+      linepos = pos;
+      if (!readRecord(rec)) return false;
+      pos += rec.size() + 1;
+      if (format == M8 ||
+	  (format == PAF ? pafToM8(rec, line) : samToM8(rec, *matesfx, line)))
+	return true;
+    }
+  }
+
+  bool readRecord(std::string &rec) {
+    if (format == BAM && !pipe)
+      return false;        // samtools has ended
+    if (!pipe) {
+      if (getline(ifs, rec)) return true;
+      failed = ifs.bad();
+      return false;
+    }
+
+    rec.clear();
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), pipe)) {
+      rec += buf;
+      if (rec[rec.size()-1] == '\n') {
+	rec.resize(rec.size()-1);
+	return true;
+      }
+    }
+    if (!rec.empty()) return true;
+
+    // at the end, samtools must have read the whole BAM
+    failed = !reap(pipe, child);
+    pipe = NULL;
+    return false;
+  }
+};
+
+#endif
@@ -0,0 +1,213 @@
+// k-mers of reads and marker genes: FASTA/FASTQ reading, 2-bit encoding,
+// translation into a reduced amino acid alphabet, and a Bloom filter
+
+#ifndef KMER_H
+#define KMER_H
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+typedef unsigned int Uint;
+typedef uint64_t     Kmer;
+
+
+// one FASTA or FASTQ record
+struct SeqRecord {
+  std::string header;      // header line, with '>' or '@'
+  std::string seq;
+  std::string qual;        // empty for FASTA
+};
+
+
+// reads FASTA (also multi-line) or FASTQ records
+struct SeqReader {
+  std::istream *is;
+  std::string  line;       // header of next record
+  bool         more;
+
+  SeqReader(std::istream &in) : is(&in), more(false) {
+    while (getline(*is, line))
+      if (!line.empty() && (line[0] == '>' || line[0] == '@')) { more = true; break; }
+  }
+
+  bool next(SeqRecord &rec) {
+    if (!more) return false;
+    rec.header.swap(line);
+    rec.seq.clear();
+    rec.qual.clear();
+    more = false;
+
+    if (rec.header[0] == '@') {
+      getline(*is, rec.seq);
+      getline(*is, line);  // '+' line
+      getline(*is, rec.qual);
+      while (getline(*is, line))
+	if (!line.empty()) { more = true; break; }
+      return true;
+    }
+
+    while (getline(*is, line)) {
+      if (!line.empty() && line[0] == '>') { more = true; break; }
+      rec.seq += line;
+    }
+    return true;
+  }
+};
+
+
+// sequence ID: first word of the header, without '>' or '@'
+inline std::string seqID(const std::string &header) {
+  size_t pos = header.find_first_of(" \t");
+  return header.substr(1, pos == std::string::npos ? std::string::npos : pos-1);
+}
+
+
+// 2-bit code of a nucleotide, 4 for anything else
+inline Uint baseCode(char c) {
+  switch (c) {
+  case 'A': case 'a': return 0;
+  case 'C': case 'c': return 1;
+  case 'G': case 'g': return 2;
+  case 'T': case 't': case 'U': case 'u': return 3;
+  default:  return 4;
+  }
+}
+
+
+// canonical k-mers (smaller of forward and reverse complement) of a
+// nucleotide sequence, k <= 31; k-mers with ambiguous bases are skipped
+inline void dnaKmers(const std::string &seq, Uint k, std::vector<Kmer> &kmers) {
+
+  kmers.clear();
+  Kmer mask = (((Kmer) 1) << (2*k)) - 1, fwd = 0, rev = 0;
+  Uint len  = 0, shift = 2*(k-1);
+  for (size_t i = 0; i < seq.size(); ++i) {
+    Uint c = baseCode(seq[i]);
+    if (c > 3) { len = 0; fwd = rev = 0; continue; }
+    fwd = ((fwd << 2) | c) & mask;
+    rev = (rev >> 2) | ((Kmer) (3-c) << shift);
+    if (++len >= k)
+      kmers.push_back(fwd < rev ? fwd : rev);
+  }
+}
+
+
+// amino acids in 10 groups of similar residues (Murphy et al., 2000):
+// LVIM, C, A, G, ST, P, FYW, EDNQ, KR, H; 15 for stop and unknown
+inline Uint aaCode(char c) {
+  switch (c) {
+  case 'L': case 'V': case 'I': case 'M': return 0;
+  case 'C': return 1;
+  case 'A': return 2;
+  case 'G': return 3;
+  case 'S': case 'T': return 4;
+  case 'P': return 5;
+  case 'F': case 'Y': case 'W': return 6;
+  case 'E': case 'D': case 'N': case 'Q': return 7;
+  case 'K': case 'R': return 8;
+  case 'H': return 9;
+  default:  return 15;
+  }
+}
+
+
+// translate a nucleotide sequence in one frame (0-2), '*' for stop, 'X' for unknown
+inline void translate(const std::string &seq, Uint frame, std::string &prot) {
+
+  static const char *CODONS = "KNKNTTTTRSRSIIMIQHQHPPPPRRRRLLLLEDEDAAAAGGGGVVVV*Y*YSSSS*CWCLFLF";
+  prot.clear();
+  for (size_t i = frame; i+2 < seq.size(); i += 3) {
+    Uint c1 = baseCode(seq[i]), c2 = baseCode(seq[i+1]), c3 = baseCode(seq[i+2]);
+    prot += (c1 > 3 || c2 > 3 || c3 > 3) ? 'X' : CODONS[c1*16 + c2*4 + c3];
+  }
+}
+
+
+// reverse complement
+inline void revcomp(const std::string &seq, std::string &rc) {
+
+  rc.resize(seq.size());
+  for (size_t i = 0; i < seq.size(); ++i) {
+    Uint c = baseCode(seq[seq.size()-1-i]);
+    rc[i] = c > 3 ? 'N' : "TGCA"[c];
+  }
+}
+
+
+// k-mers of a protein sequence in the reduced alphabet, 4 bits a residue, k <= 16
+inline void protKmers(const std::string &prot, Uint k, std::vector<Kmer> &kmers, bool append = false) {
+
+  if (!append) kmers.clear();
+  Kmer mask = k == 16 ? ~(Kmer) 0 : (((Kmer) 1) << (4*k)) - 1, kmer = 0;
+  Uint len  = 0;
+  for (size_t i = 0; i < prot.size(); ++i) {
+    Uint c = aaCode(prot[i]);
+    if (c == 15) { len = 0; kmer = 0; continue; }
+    kmer = ((kmer << 4) | c) & mask;
+    if (++len >= k)
+      kmers.push_back(kmer);
+  }
+}
+
+
+// reduced alphabet k-mers of all six reading frames of a read
+inline void sixFrameKmers(const std::string &seq, Uint k, std::vector<Kmer> &kmers) {
+
+  std::string rc, prot;
+  revcomp(seq, rc);
+  kmers.clear();
+  for (Uint frame = 0; frame < 3; ++frame) {
+    translate(seq, frame, prot);
+    protKmers(prot, k, kmers, true);
+    translate(rc, frame, prot);
+    protKmers(prot, k, kmers, true);
+  }
+}
+
+
+// mix the bits of a k-mer (splitmix64 finalizer)
+inline uint64_t hashKmer(Kmer x) {
+  x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+
+// Bloom filter of k-mers; positions are derived from one hash by double hashing
+struct BloomFilter {
+  std::vector<uint64_t> bits;
+  uint64_t mask;           // number of bits - 1, a power of 2
+  Uint     nhash;
+
+  // about bitsper bits for each of n k-mers
+  void init(uint64_t n, Uint bitsper, Uint nh) {
+    uint64_t nbits = 64;
+    while (nbits < n*bitsper) nbits <<= 1;
+    bits.assign(nbits / 64, 0);
+    mask  = nbits - 1;
+    nhash = nh;
+  }
+
+  // safe to call from several threads at once
+  void insert(Kmer kmer) {
+    uint64_t h = hashKmer(kmer), h2 = (h >> 32) | 1;
+    for (Uint i = 0; i < nhash; ++i, h += h2) {
+      uint64_t pos = h & mask;
+      __sync_fetch_and_or(&bits[pos >> 6], ((uint64_t) 1) << (pos & 63));
+    }
+  }
+
+  bool contains(Kmer kmer) const {
+    uint64_t h = hashKmer(kmer), h2 = (h >> 32) | 1;
+    for (Uint i = 0; i < nhash; ++i, h += h2) {
+      uint64_t pos = h & mask;
+      if (!(bits[pos >> 6] & (((uint64_t) 1) << (pos & 63)))) return false;
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,359 @@
+// Classify reads from exact k-mer matches to marker genes, before BLAST:
+// each k-mer of the markers is labeled with the lowest common ancestor
+// (LCA) of the genes it occurs in, and a read whose k-mers all agree on
+// one taxon at the requested level, or below it, is classified right away.
+// Other reads are printed out, to be aligned and classified by
+// metaphylerClassify; classifications are in its format.
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+
+#include <sstream>
+using std::istringstream;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <unordered_map>
+using std::unordered_map;
+
+#include <cstdlib>
+#include <cstdio>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "kmer.h"
+#include "taxdb.h"
+
+typedef vector<string>             VS;
+typedef vector<Uint>               VI;
+
+const Uint TLEV = 6;
+const Uint BATCHSIZE = 20000;   // reads per thread in a batch
+
+struct Cmdopts {
+  string markerfile,
+	 taxfile,
+	 queryfile,
+	 outfile;
+  Uint   k,
+	 level,          // reads must be unambiguous at this level
+	 minhits,
+	 nthreads;
+  bool   protein;        // markers are proteins, reads are translated (blastx)
+};
+
+// LCA of genes: their labels agree from level lev up, as in lineage lin
+struct LCA {
+  Uint lin, lev;
+};
+
+typedef unordered_map<Kmer, LCA>   K2LCA;
+
+struct Index {
+  K2LCA      kmer2lca;
+  vector<VS> lineages;   // labels, lowest level first
+};
+
+// reads of a part of a batch; a classified read gets its output line
+struct Job {
+  const Cmdopts     *cmdopts;
+  const Index       *index;
+  vector<SeqRecord> *recs;
+  vector<string>    *lines;
+  size_t            begin, end;
+};
+
+void helpmsg();
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
+void buildIndex(const Cmdopts &cmdopts, Index &index);
+void classifyReads(const Cmdopts &cmdopts, const Index &index);
+void *classifyJob(void *arg);
+inline void mergeLCA(const vector<VS> &lineages, LCA &lca, const LCA &other);
+void printRecord(const SeqRecord &rec);
+
+
+int main(int argc, char *argv[]) {
+
+  // read in command line options
+  Cmdopts cmdopts;
+  getcmdopts(argc, argv, cmdopts);
+
+
+  // LCA of each k-mer of marker genes
+  Index index;
+  buildIndex(cmdopts, index);
+
+
+  // classify unambiguous reads, print out the others
+  classifyReads(cmdopts, index);
+
+  return 0;
+}
+
+
+// LCA of two LCAs: the lowest level, at or above both, where their labels
+// are the same and not NA; past the top level if there is none
+inline void mergeLCA(const vector<VS> &lineages, LCA &lca, const LCA &other) {
+
+  if (lca.lin == other.lin) {
+    if (other.lev > lca.lev) lca.lev = other.lev;
+    return;
+  }
+
+  const VS &labs1 = lineages[lca.lin], &labs2 = lineages[other.lin];
+  Uint lev = lca.lev > other.lev ? lca.lev : other.lev;
+  while (lev < labs1.size() && lev < labs2.size()
+	 && (labs1[lev] == "NA" || labs1[lev] != labs2[lev]))
+    ++lev;
+  lca.lev = lev < labs1.size() && lev < labs2.size() ? lev : TAXDBNONE;
+}
+
+
+// LCA of every k-mer of marker genes that have a lineage
+void buildIndex(const Cmdopts &cmdopts, Index &index) {
+
+  Taxonomy tax;
+  VI       gene2lin;
+  string   err;
+  if (!readLineages(cmdopts.taxfile, tax, gene2lin, index.lineages, err)) {
+    cerr << err << endl;
+    exit(1);
+  }
+
+  ifstream ifs(cmdopts.markerfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.markerfile << endl;
+    exit(1);
+  }
+
+  SeqReader reader(ifs);
+  SeqRecord rec;
+  vector<Kmer> kmers;
+  Uint ngenes = 0;
+  while (reader.next(rec)) {
+    int gnum = tax.findGene(seqID(rec.header).c_str());
+    if (gnum < 0) continue;
+    ++ngenes;
+
+    LCA gene = {gene2lin[gnum], 0};
+    cmdopts.protein ? protKmers(rec.seq, cmdopts.k, kmers) : dnaKmers(rec.seq, cmdopts.k, kmers);
+    for (vector<Kmer>::const_iterator citer = kmers.begin(); citer != kmers.end(); ++citer) {
+      std::pair<K2LCA::iterator, bool> ins = index.kmer2lca.insert(K2LCA::value_type(*citer, gene));
+      if (!ins.second && ins.first->second.lev != TAXDBNONE)
+	mergeLCA(index.lineages, ins.first->second, gene);
+    }
+  }
+
+  cerr << index.kmer2lca.size() << " k-mers of " << ngenes << " genes" << endl;
+}
+
+
+// read query in batches, classify reads of a batch in parallel; the
+// classified ones go to the output file, the others are printed out,
+// both in the input order
+void classifyReads(const Cmdopts &cmdopts, const Index &index) {
+
+  ifstream ifs(cmdopts.queryfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.queryfile << endl;
+    exit(1);
+  }
+
+  ofstream ofs(cmdopts.outfile.c_str());
+  if (!ofs) {
+    cerr << "Could not open file " << cmdopts.outfile << endl;
+    exit(1);
+  }
+
+  Uint nthreads = cmdopts.nthreads;
+  SeqReader reader(ifs);
+  vector<SeqRecord> recs(BATCHSIZE * nthreads); // reused for every batch
+  vector<string>    lines(recs.size());
+  vector<Job>       jobs(nthreads);
+  vector<pthread_t> threads(nthreads);
+  uint64_t nreads = 0, nclsf = 0;
+  for (;;) {
+    size_t n = 0;
+    while (n < recs.size() && reader.next(recs[n])) ++n;
+    if (n == 0) break;
+
+    for (Uint i = 0; i < nthreads; ++i) {
+      Job job = {&cmdopts, &index, &recs, &lines, n * i / nthreads, n * (i+1) / nthreads};
+      jobs[i] = job;
+      if (i > 0 && pthread_create(&threads[i], NULL, classifyJob, &jobs[i]) != 0) {
+	cerr << "Could not create thread" << endl;
+	exit(1);
+      }
+    }
+    classifyJob(&jobs[0]);
+    for (Uint i = 1; i < nthreads; ++i)
+      pthread_join(threads[i], NULL);
+
+    for (size_t i = 0; i < n; ++i) {
+      if (lines[i].empty())
+	printRecord(recs[i]);
+      else {
+	ofs << lines[i];
+	++nclsf;
+      }
+    }
+    nreads += n;
+  }
+
+  ofs.close();
+  if (!ofs) {
+    cerr << "Could not write file " << cmdopts.outfile << endl;
+    exit(1);
+  }
+  cerr << nclsf << " of " << nreads << " reads classified at " << levname(cmdopts.level)
+       << " from k-mers" << endl;
+}
+
+
+void *classifyJob(void *arg) {
+
+  Job &job = *(Job *) arg;
+  const Cmdopts &cmdopts = *job.cmdopts;
+  const Index   &index   = *job.index;
+
+  vector<Kmer> kmers;
+  for (size_t i = job.begin; i < job.end; ++i) {
+    const SeqRecord &rec = (*job.recs)[i];
+    string &line = (*job.lines)[i];
+    line.clear();
+
+    cmdopts.protein ? sixFrameKmers(rec.seq, cmdopts.k, kmers) : dnaKmers(rec.seq, cmdopts.k, kmers);
+
+    // LCA of all k-mers shared with markers
+    LCA  lca = {0, 0};
+    Uint hits = 0;
+    for (vector<Kmer>::const_iterator citer = kmers.begin(); citer != kmers.end(); ++citer) {
+      K2LCA::const_iterator kiter = index.kmer2lca.find(*citer);
+      if (kiter == index.kmer2lca.end()) continue;
+      if (hits++ == 0)
+	lca = kiter->second;
+      else
+	mergeLCA(index.lineages, lca, kiter->second);
+      if (lca.lev == TAXDBNONE) break;  // no taxon in common
+    }
+    if (hits < cmdopts.minhits || lca.lev > cmdopts.level) continue;
+
+    const VS &labs = index.lineages[lca.lin];
+    if (cmdopts.level >= labs.size() || labs[cmdopts.level] == "NA") continue;
+
+    // levels below the LCA are unknown
+    line = seqID(rec.header) + "\t";
+    for (Uint lev = 0; lev < labs.size(); ++lev) {
+      if (lev < lca.lev || labs[lev] == "NA")
+	line += "NA\t";
+      else
+	line += labs[lev] + "(1.000)\t";
+    }
+    line += "\n";
+  }
+  return NULL;
+}
+
+
+// print a read in its input format
+void printRecord(const SeqRecord &rec) {
+
+  cout << rec.header << "\n" << rec.seq << "\n";
+  if (rec.header[0] == '@')
+    cout << "+\n" << rec.qual << "\n";
+}
+
+
+// parse command line options
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
+
+  cmdopts.k        = 0;
+  cmdopts.level    = 1;
+  cmdopts.minhits  = 3;
+  cmdopts.nthreads = 1;
+  cmdopts.protein  = false;
+
+  string level = "";
+  int opt;
+  while ((opt = getopt(argc, argv, "k:l:n:t:x")) != -1) {
+    switch (opt) {
+    case 'k': cmdopts.k        = atoi(optarg); break;
+    case 'l': level            = optarg; break;
+    case 'n': cmdopts.minhits  = atoi(optarg); break;
+    case 't': cmdopts.nthreads = atoi(optarg); break;
+    case 'x': cmdopts.protein  = true; break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+
+  if (argc - optind != 4) {
+    helpmsg();
+    exit(1);
+  }
+  cmdopts.markerfile = argv[optind];
+  cmdopts.taxfile    = argv[optind+1];
+  cmdopts.queryfile  = argv[optind+2];
+  cmdopts.outfile    = argv[optind+3];
+
+  if (level != "") {
+    for (cmdopts.level = 0; cmdopts.level < TLEV && levname(cmdopts.level) != level; ++cmdopts.level) ;
+    if (cmdopts.level == TLEV) {
+      cerr << "Unknown level " << level << endl;
+      exit(1);
+    }
+  }
+
+  if (cmdopts.k == 0) cmdopts.k = cmdopts.protein ? 11 : 31;
+  if (cmdopts.nthreads == 0) cmdopts.nthreads = 1;
+  if (cmdopts.minhits == 0) cmdopts.minhits = 1;
+  if (cmdopts.k > (cmdopts.protein ? 16u : 31u)) {
+    helpmsg();
+    exit(1);
+  }
+}
+
+
+// print out usage help message
+void helpmsg() {
+  cerr << endl;
+
+  cerr << "Usage:" << endl;
+  cerr << "        ./kmerLCA [options] <markers> <taxonomy> <query> <classification>" << endl;
+  cerr << endl;
+  cerr << "        Classify reads whose k-mers shared with marker genes all agree on one" << endl;
+  cerr << "        taxon at a level, and print out the other reads, for BLAST." << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "        <markers>        Marker genes in FASTA format (e.g., markers.dna)." << endl << endl;
+  cerr << "        <taxonomy>       Taxonomy labels of marker genes (e.g., markers.taxonomy)," << endl;
+  cerr << "                         or a database compiled by taxdb." << endl << endl;
+  cerr << "        <query>          Reads in FASTA or FASTQ format." << endl << endl;
+  cerr << "        <classification> Output file of classified reads, as of metaphylerClassify." << endl << endl;
+  cerr << "        -l <level>       Reads must be unambiguous at this level: species, genus," << endl;
+  cerr << "                         family, order, class or phylum (default: genus)." << endl << endl;
+  cerr << "        -x               Markers are proteins (e.g., markers.protein), for blastx." << endl;
+  cerr << "                         Reads are translated in six frames, and amino acids are" << endl;
+  cerr << "                         compared in a reduced alphabet of 10 letters." << endl << endl;
+  cerr << "        -k <k>           k-mer length (default: 31; 11 amino acids with -x)." << endl << endl;
+  cerr << "        -n <hits>        k-mers a read must share with markers (default: 3)." << endl << endl;
+  cerr << "        -t <threads>     Number of threads (default: 1)." << endl << endl;
+
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
+}
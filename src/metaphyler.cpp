@@ -0,0 +1,888 @@
+// Classification of reads from their BLAST hits to reference genes, using
+// models trained by metaphylerTrain; see metaphyler.h
+
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+
+#include <sstream>
+using std::istringstream;
+using std::ostringstream;
+
+#include <map>
+using std::map;
+
+#include <vector>
+using std::vector;
+
+#include <string>
+using std::string;
+
+#include <algorithm>
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metaphyler.h"
+#include "taxdb.h"
+
+const float PCTCUT = 50.0;
+
+typedef unsigned short int   Usint;
+typedef unsigned int         Uint;
+typedef vector<string>       VS;
+typedef vector<Usint>        VSI;
+typedef map<string, VSI>     S2VSI;
+typedef map<Usint, S2VSI>    SI2S2VSI;
+typedef vector<float>        VF;
+typedef vector<Uint>         VU;
+
+const Uint NLENCUT = 60;   // shortest HSP used for classification, blastn
+const Uint XLENCUT = 20;   // blastx, in amino acids
+
+// All models flattened into one position-independent image, so that it can
+// be placed in a POSIX shared memory segment (or a file mapped read-only) and
+// used by many classifier processes at the same time.
+// Layout: header, key, lengths, genes, label offsets, score index, scores, strings.
+const char MODELMAGIC[8] = {'M', 'P', 'H', 'Y', 'M', 'O', 'D', '1'};
+
+namespace {
+
+struct ModelHeader {
+  char     magic[8];
+  uint64_t size;           // bytes of the whole image
+  uint64_t keyoff, lenoff, geneoff, laboff, idxoff, scoreoff, stroff;
+  Uint     keylen, ngenes, nlens, lencut;
+  volatile Uint ready;     // set by the publisher once the image is complete
+};
+
+struct ModelGene {
+  Uint  idoff;             // gene ID in string pool
+  Uint  laboff;            // first of nlevs-1 label offsets
+  Usint nlevs;
+};
+
+struct ModelIdx {
+  uint64_t off;            // first score in score pool
+  Uint     size;           // 0 if no model for this gene at this length
+};
+
+}
+
+struct Model {
+  vector<char>      local; // owns the image if it is not shared
+  size_t            mapped;// bytes mapped, if it is shared
+  Uint              width; // most levels of a classification
+  const char        *base;
+  const ModelHeader *hdr;
+  const Usint       *lens;
+  const ModelGene   *genes;
+  const Uint        *labs;
+  const ModelIdx    *idx;
+  const Usint       *scores;
+  const char        *strs;
+
+  Model() : mapped(0), width(0) {}
+  ~Model() { if (mapped) munmap((void *) base, mapped); }
+  int findGene(const char *rid) const;
+  const char *label(Uint gene, Uint lev) const { return strs + labs[genes[gene].laboff+lev]; }
+};
+
+namespace {
+
+// one BLAST hit of a query that passed the filters
+struct Hit {
+  int   gene;
+  Usint hsp;
+  Uint  bit;
+  Usint mate;              // 1 or 2 for mates of a read pair, otherwise 0
+};
+typedef vector<Hit> VH;
+
+// classification of a query: label and confidence score at each level
+struct Clsf {
+  vector<const char *> tax;
+  VF                   confs;
+};
+typedef vector<Clsf> VClsf;
+
+}
+
+static bool loadModel(const VS &scorefiles, const string &taxfile, const string &shmname, Model &model, string &err);
+static bool readTaxFile(string taxfile, Taxonomy &tax, VU &genes, string &err);
+static bool getScores(string scorefile, SI2S2VSI &len2seq2scores, Uint &lencut, string &err);
+static void setScores(const Taxonomy &tax, const VU &genes, S2VSI &seq2scores);
+static bool modelKey(const VS &scorefiles, const string &taxfile, string &key, string &err);
+static void buildModel(const Taxonomy &tax, const VU &genes, const SI2S2VSI &len2seq2scores,
+		       const string &key, Uint lencut, vector<char> &image);
+static void setModel(const char *base, Model &model);
+static int  attachModel(const string &name, const string &key, Model &model, string &err);
+static bool publishModel(const string &name, const string &key, const vector<char> &image, Model &model, string &err);
+static bool parseHit(const Model &model, const ClassifierHit &chit, Hit &hit);
+static bool classifyQuery(const VH &hits, const Model &model, Classifier::Combine combine, Clsf &clsf, Clsf &mclsf, VClsf &hclsfs);
+static void combineHits(const Model &model, const Hit *hits, Uint nhits, Classifier::Combine combine, Clsf &clsf, VClsf &hclsfs);
+static void classifyHit(const Model &model, const Hit &hit, Clsf &clsf);
+static void mergeBest(Clsf &clsf, const Clsf &other);
+static void mergeConsensus(const Model &model, const Hit *hits, Uint nhits, Clsf &clsf, VClsf &hclsfs);
+static VF   computeConf(const Model &model, Uint gene, Uint len, Uint bit);
+static inline float average(const VF &ary);
+
+
+Classifier::Classifier() : model(NULL) {}
+
+Classifier::~Classifier() {
+  delete model;
+}
+
+
+// a failed load keeps the models loaded before, if any
+bool Classifier::load(const VS &scorefiles, const string &taxfile, const string &shmname) {
+
+  Model *loaded = new Model;
+  err.clear();
+  if (!loadModel(scorefiles, taxfile, shmname, *loaded, err)) {
+    delete loaded;
+    return false;
+  }
+  delete model;
+  model = loaded;
+  return true;
+}
+
+
+unsigned Classifier::nlevels() const {
+  return model ? model->width : 0;
+}
+
+
+// hits of a query are gathered (only the top hit of each mate in first mode)
+// and classified together, as in classifyQuery; buffers are local, so
+// threads can share the model
+size_t Classifier::classify(const ClassifierHit *hits, size_t nhits, Combine combine, size_t maxqueries,
+			    size_t *first, const char **labels, float *confs, size_t *used) const {
+
+  Uint   width = nlevels();
+  VH     qhits;           // hits of current query that passed the filters
+  Clsf   clsf, mclsf;     // classification of current query, and of its second mate
+  VClsf  hclsfs;          // classification of each hit
+  size_t nqueries = 0, h = 0;
+  while (model && h < nhits && nqueries < maxqueries) {
+
+    size_t end = h + 1;
+    while (end < nhits && strcmp(hits[end].query, hits[h].query) == 0) ++end;
+
+    qhits.clear();
+    for (size_t k = h; k < end; ++k) {
+      if (combine == FIRST && k > h && hits[k].mate == hits[k-1].mate) continue;
+      Hit hit;
+      if (parseHit(*model, hits[k], hit)) {
+	hit.mate = hits[k].mate;
+	qhits.push_back(hit);
+      }
+    }
+
+    const char **qlabels = labels + nqueries*width;
+    float       *qconfs  = confs  + nqueries*width;
+    std::fill(qlabels, qlabels + width, (const char *) NULL);
+    std::fill(qconfs,  qconfs  + width, 0.0f);
+    if (classifyQuery(qhits, *model, combine, clsf, mclsf, hclsfs)) {
+      std::copy(clsf.tax.begin(), clsf.tax.end(), qlabels);
+      std::copy(clsf.confs.begin(), clsf.confs.end(), qconfs);
+    }
+
+    first[nqueries++] = h;
+    h = end;
+  }
+
+  if (used) *used = h;
+  return nqueries;
+}
+
+
+// as mergeBest, on rows of classify() output
+void Classifier::mergeBest(const char **labels, float *confs,
+			   const char *const *labels2, const float *confs2, unsigned width) {
+
+  for (unsigned i = 0; i < width && labels2[i]; ++i) {
+    if (strcmp(labels2[i], "NA") == 0) {
+      if (!labels[i]) {
+	labels[i] = "NA";
+	confs[i]  = 0.0;
+      }
+      continue;
+    }
+    if (!labels[i] || strcmp(labels[i], "NA") == 0 || confs[i] < confs2[i]) {
+      labels[i] = labels2[i];
+      confs[i]  = confs2[i];
+    }
+  }
+}
+
+
+// read in taxonomy and models, and flatten them into an image
+// if a shared segment is given, attach to it, or publish the image there
+// returns false on errors, described in err
+static bool loadModel(const VS &scorefiles, const string &taxfile, const string &shmname, Model &model, string &err) {
+
+  string key;
+  if (!modelKey(scorefiles, taxfile, key, err))
+    return false;
+  if (!shmname.empty()) {
+    int attached = attachModel(shmname, key, model, err);
+    if (attached != 0) return attached > 0;
+  }
+
+
+  // read in taxonomic labels for each reference gene
+  Taxonomy tax;
+  VU       genes;
+  if (!readTaxFile(taxfile, tax, genes, err))
+    return false;
+
+  
+  // read in cutoff file
+  SI2S2VSI len2seq2scores;
+  S2VSI seq2scores;
+  Uint lencut = NLENCUT;
+  for (VS::const_iterator citer = scorefiles.begin(); citer != scorefiles.end(); ++citer) {
+    if (!getScores(*citer, len2seq2scores, lencut, err))
+      return false;
+  }
+
+  // prepare for classification
+  for (SI2S2VSI::iterator citer = len2seq2scores.begin(); citer != len2seq2scores.end(); ++citer) {
+    setScores(tax, genes, citer->second);
+  }
+
+  if (len2seq2scores.empty()) {
+    err = "No models found in " + (scorefiles.empty() ? string("") : scorefiles[0]);
+    return false;
+  }
+
+
+  vector<char> image;
+  buildModel(tax, genes, len2seq2scores, key, lencut, image);
+
+  if (!shmname.empty())
+    return publishModel(shmname, key, image, model, err);
+
+  model.local.swap(image);
+  setModel(&model.local[0], model);
+  return true;
+}
+
+
+// identifies the files a model image was built from,
+// so that a stale shared segment is never used by mistake
+static bool modelKey(const VS &scorefiles, const string &taxfile, string &key, string &err) {
+
+  VS files(scorefiles);
+  files.push_back(taxfile);
+
+  ostringstream oss;
+  for (VS::const_iterator citer = files.begin(); citer != files.end(); ++citer) {
+    struct stat st;
+    if (stat(citer->c_str(), &st) != 0) {
+      err = "Could not open file " + *citer;
+      return false;
+    }
+    oss << *citer << ":" << st.st_size << ":" << st.st_mtime << ";";
+  }
+  key = oss.str();
+  return true;
+}
+
+
+// round up to 8 bytes, so every section of the image is aligned
+static inline uint64_t align8(uint64_t n) {
+  return (n + 7) & ~(uint64_t)7;
+}
+
+
+// flatten taxonomy and models into one image
+// genes are sorted by ID (as in genes), so they can be found by binary search
+static void buildModel(const Taxonomy &tax, const VU &genes, const SI2S2VSI &len2seq2scores,
+		       const string &key, Uint lencut, vector<char> &image) {
+
+  Uint ngenes = genes.size(), nlens = len2seq2scores.size();
+
+  // string pool: gene IDs, and each distinct taxonomic label once;
+  // offsets by label number, NA last
+  string strs;
+  VU   lab2off(tax.nlabels()+1, TAXDBNONE);
+  Uint nlabs = 0;
+  uint64_t nscores = 0;
+  for (VU::const_iterator giter = genes.begin(); giter != genes.end(); ++giter) {
+    for (Uint lev = 0; lev < tax.nlabs(*giter); ++lev) {
+      Uint lab = tax.labelAt(*giter, lev);
+      Uint &off = lab2off[lab == TAXDBNONE ? tax.nlabels() : lab];
+      if (off == TAXDBNONE) {
+	off = strs.size();
+	strs.append(tax.label(*giter, lev), strlen(tax.label(*giter, lev))+1);
+      }
+    }
+    nlabs += tax.nlabs(*giter);
+    for (SI2S2VSI::const_iterator liter = len2seq2scores.begin(); liter != len2seq2scores.end(); ++liter) {
+      S2VSI::const_iterator siter = liter->second.find(tax.geneID(*giter));
+      if (siter != liter->second.end())
+	nscores += siter->second.size();
+    }
+  }
+
+  ModelHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, MODELMAGIC, sizeof(hdr.magic));
+  hdr.keylen   = key.size();
+  hdr.ngenes   = ngenes;
+  hdr.nlens    = nlens;
+  hdr.lencut   = lencut;
+  hdr.keyoff   = align8(sizeof(ModelHeader));
+  hdr.lenoff   = align8(hdr.keyoff + key.size() + 1);
+  hdr.geneoff  = align8(hdr.lenoff + nlens*sizeof(Usint));
+  hdr.laboff   = align8(hdr.geneoff + ngenes*sizeof(ModelGene));
+  hdr.idxoff   = align8(hdr.laboff + nlabs*sizeof(Uint));
+  hdr.scoreoff = align8(hdr.idxoff + (uint64_t)ngenes*nlens*sizeof(ModelIdx));
+  hdr.stroff   = align8(hdr.scoreoff + nscores*sizeof(Usint));
+  hdr.ready    = 1;
+
+  // gene IDs go after the labels in the string pool
+  uint64_t idbytes = 0;
+  for (VU::const_iterator giter = genes.begin(); giter != genes.end(); ++giter)
+    idbytes += strlen(tax.geneID(*giter)) + 1;
+  hdr.size     = align8(hdr.stroff + strs.size() + idbytes);
+
+  image.assign(hdr.size, 0);
+  char *base = &image[0];
+  memcpy(base, &hdr, sizeof(hdr));
+  memcpy(base + hdr.keyoff, key.c_str(), key.size());
+
+  Usint *lens = (Usint *) (base + hdr.lenoff);
+  for (SI2S2VSI::const_iterator liter = len2seq2scores.begin(); liter != len2seq2scores.end(); ++liter)
+    *lens++ = liter->first;
+
+  ModelGene *mgenes = (ModelGene *) (base + hdr.geneoff);
+  Uint      *labs   = (Uint *) (base + hdr.laboff);
+  ModelIdx  *idx    = (ModelIdx *) (base + hdr.idxoff);
+  Usint     *scores = (Usint *) (base + hdr.scoreoff);
+  char      *pool   = base + hdr.stroff;
+  memcpy(pool, strs.data(), strs.size());
+
+  Uint stroff = strs.size(), laboff = 0;
+  uint64_t scoreoff = 0;
+  for (VU::const_iterator giter = genes.begin(); giter != genes.end(); ++giter, ++mgenes) {
+
+    const char *id = tax.geneID(*giter);
+    memcpy(pool + stroff, id, strlen(id));
+    mgenes->idoff  = stroff;
+    mgenes->laboff = laboff;
+    mgenes->nlevs  = tax.nlabs(*giter) + 1;
+    stroff += strlen(id) + 1;
+
+    for (Uint lev = 0; lev < tax.nlabs(*giter); ++lev) {
+      Uint lab = tax.labelAt(*giter, lev);
+      labs[laboff++] = lab2off[lab == TAXDBNONE ? tax.nlabels() : lab];
+    }
+
+    for (SI2S2VSI::const_iterator liter = len2seq2scores.begin(); liter != len2seq2scores.end(); ++liter, ++idx) {
+      idx->off  = scoreoff;
+      idx->size = 0;
+      S2VSI::const_iterator siter = liter->second.find(id);
+      if (siter == liter->second.end()) continue;
+      idx->size = siter->second.size();
+      if (!siter->second.empty())
+	memcpy(scores + scoreoff, &siter->second[0], siter->second.size()*sizeof(Usint));
+      scoreoff += siter->second.size();
+    }
+  }
+}
+
+
+// point the model at an image
+static void setModel(const char *base, Model &model) {
+  model.base   = base;
+  model.hdr    = (const ModelHeader *) base;
+  model.lens   = (const Usint *) (base + model.hdr->lenoff);
+  model.genes  = (const ModelGene *) (base + model.hdr->geneoff);
+  model.labs   = (const Uint *) (base + model.hdr->laboff);
+  model.idx    = (const ModelIdx *) (base + model.hdr->idxoff);
+  model.scores = (const Usint *) (base + model.hdr->scoreoff);
+  model.strs   = base + model.hdr->stroff;
+
+  model.width  = 0;
+  for (Uint gene = 0; gene < model.hdr->ngenes; ++gene)
+    model.width = std::max(model.width, (Uint) model.genes[gene].nlevs - 1);
+}
+
+
+// binary search for a gene ID, -1 if not found
+int Model::findGene(const char *rid) const {
+
+  int lo = 0, hi = hdr->ngenes - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int cmp = strcmp(strs + genes[mid].idoff, rid);
+    if (cmp == 0) return mid;
+    cmp < 0 ? lo = mid + 1 : hi = mid - 1;
+  }
+  return -1;
+}
+
+
+// open an existing segment (or image file) read-only
+// returns 1 if attached, 0 if it does not exist yet, -1 on errors
+static int attachModel(const string &name, const string &key, Model &model, string &err) {
+
+  bool isfile = name.find('/') != string::npos;
+  int fd = isfile ? open(name.c_str(), O_RDONLY) : shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    if (errno == ENOENT) return 0;
+    err = "Could not open shared model " + name + ": " + strerror(errno);
+    return -1;
+  }
+
+  // another process may still be writing it; wait until it is complete
+  const char *base = NULL;
+  struct stat st;
+  for (Uint wait = 0; ; ++wait) {
+    if (wait == 6000) { // 10 minutes
+      err = "Shared model " + name + " is incomplete; remove it and rerun.";
+      break;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(ModelHeader)) {
+      if (base == NULL) {
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+	  err = "Could not map shared model " + name + ": " + strerror(errno);
+	  break;
+	}
+	base = (const char *) addr;
+      }
+      if (((const ModelHeader *) base)->ready) break;
+    }
+    usleep(100000);
+  }
+  close(fd);
+  __sync_synchronize();
+
+  const ModelHeader *hdr = (const ModelHeader *) base;
+  if (err.empty() && (memcmp(hdr->magic, MODELMAGIC, sizeof(hdr->magic)) != 0 || hdr->size != (uint64_t) st.st_size))
+    err = "Shared model " + name + " is not a MetaPhyler model image";
+  else if (err.empty() && key != string(base + hdr->keyoff, hdr->keylen))
+    err = "Shared model " + name + " was built from different model files; remove it and rerun.";
+  if (!err.empty()) {
+    if (base) munmap((void *) base, st.st_size);
+    return -1;
+  }
+
+  setModel(base, model);
+  model.mapped = st.st_size;
+  return 1;
+}
+
+
+// copy the image into a new segment, so later processes can attach to it
+// if another process published it in the meantime, use that one instead
+static bool publishModel(const string &name, const string &key, const vector<char> &image, Model &model, string &err) {
+
+  if (name.find('/') != string::npos) {
+
+    // image file: write it under a temporary name, then rename it into place
+    ostringstream tmp;
+    tmp << name << ".tmp" << getpid();
+    ofstream ofs(tmp.str().c_str(), std::ios::binary);
+    ofs.write(&image[0], image.size());
+    ofs.close();
+    if (!ofs || rename(tmp.str().c_str(), name.c_str()) != 0) {
+      err = "Could not write model image " + name;
+      unlink(tmp.str().c_str());
+      return false;
+    }
+    int attached = attachModel(name, key, model, err);
+    if (attached == 0)
+      err = "Could not open model image " + name;
+    return attached > 0;
+  }
+
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    if (errno == EEXIST) {
+      int attached = attachModel(name, key, model, err);
+      if (attached != 0) return attached > 0;
+      errno = EEXIST;
+    }
+    err = "Could not create shared model " + name + ": " + strerror(errno);
+    return false;
+  }
+
+  void *addr = MAP_FAILED;
+  if (ftruncate(fd, image.size()) == 0)
+    addr = mmap(NULL, image.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    err = "Could not create shared model " + name + ": " + strerror(errno);
+    shm_unlink(name.c_str());
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  // header goes last, and it is only marked ready after everything else is in place
+  char *base = (char *) addr;
+  ModelHeader hdr;
+  memcpy(&hdr, &image[0], sizeof(hdr));
+  hdr.ready = 0;
+  memcpy(base + sizeof(ModelHeader), &image[0] + sizeof(ModelHeader), image.size() - sizeof(ModelHeader));
+  memcpy(base, &hdr, sizeof(hdr));
+  __sync_synchronize();
+  ((ModelHeader *) base)->ready = 1;
+
+  mprotect(addr, image.size(), PROT_READ);
+  setModel(base, model);
+  model.mapped = image.size();
+  return true;
+}
+
+
+// the average of an array
+static inline float average(const VF &ary) {
+  float ave = 0;
+  for (VF::const_iterator citer = ary.begin(); citer != ary.end(); ++citer)
+    ave += *citer;
+  return ave/ary.size();
+}
+
+
+// a hit of a query in the model
+// returns false if the hit can not be used for classification
+static bool parseHit(const Model &model, const ClassifierHit &chit, Hit &hit) {
+
+  hit.gene = model.findGene(chit.ref);
+  if (hit.gene < 0) return false; // does not have classifier or taxonomic label for it
+
+  if (chit.identity < PCTCUT) return false;
+
+  hit.hsp  = chit.length;
+  if (hit.hsp < model.hdr->lencut) return false;
+
+  hit.bit  = chit.bit;
+  return true;
+}
+
+
+// classify a query from all its hits
+// mates of a read pair are classified separately, then merged like hits in best mode
+// returns true if the query is classified with confidence at any level
+static bool classifyQuery(const VH &hits, const Model &model, Classifier::Combine combine, Clsf &clsf, Clsf &mclsf, VClsf &hclsfs) {
+
+  if (hits.empty()) return false;
+
+  Uint split = 1;       // hits of second mate follow hits of first mate
+  while (split < hits.size() && hits[split].mate == hits[0].mate) ++split;
+
+  combineHits(model, &hits[0], split, combine, clsf, hclsfs);
+  if (split < hits.size()) {
+    combineHits(model, &hits[split], hits.size()-split, combine, mclsf, hclsfs);
+    mergeBest(clsf, mclsf);
+  }
+
+  return *max_element(clsf.confs.begin(), clsf.confs.end()) >= 0.001;
+}
+
+
+// classify a read from its hits
+static void combineHits(const Model &model, const Hit *hits, Uint nhits, Classifier::Combine combine, Clsf &clsf, VClsf &hclsfs) {
+
+  if (combine == Classifier::CONSENSUS && nhits > 1)
+    mergeConsensus(model, hits, nhits, clsf, hclsfs);
+
+  else {
+    classifyHit(model, hits[0], clsf);
+    if (combine == Classifier::BEST) {
+      if (hclsfs.empty()) hclsfs.resize(1);
+      for (Uint h = 1; h < nhits; ++h) {
+	classifyHit(model, hits[h], hclsfs[0]);
+	mergeBest(clsf, hclsfs[0]);
+      }
+    }
+  }
+}
+
+
+// compute confidence scores of a hit, using models of the closest lengths
+static void classifyHit(const Model &model, const Hit &hit, Clsf &clsf) {
+
+  Uint  gene  = hit.gene;
+  Usint hsp   = hit.hsp;
+  Uint  bit   = hit.bit;
+  Uint  nlens = model.hdr->nlens;
+  VF   &confs = clsf.confs; // confidence scores at each level
+
+  // if hsp length is smaller than the shortest length from available models,
+  // then use it, but do not scale bit socre
+  if (hsp < model.lens[0])
+    confs = computeConf(model, gene, 0, bit);
+
+  // if hsp length is bigger than the longest length from available models,
+  // then use it, scale the bit score according to length
+  else if (hsp > model.lens[nlens-1])
+    confs = computeConf(model, gene, nlens-1, bit*(model.lens[nlens-1])/hsp);
+
+  else {
+
+    // iterate through all models for different read lengths
+    // suppose hsp length is 150bp; we have models for 100bp and 200 bp
+    // then we try classification using both models,
+    // and use the one with higher average confidence score
+    for (Uint l = 0; l < nlens; ++l) {
+
+      if (hsp == model.lens[l]) { // if exactly the same, then just use this model
+	confs = computeConf(model, gene, l, bit);
+	break;
+      }
+	
+      else if (hsp < model.lens[l]) {
+	confs = computeConf(model, gene, l, bit);
+	VF confs2 = computeConf(model, gene, l-1, bit*(model.lens[l-1])/hsp);
+	if (average(confs) < average(confs2)) confs = confs2;
+	break;
+      }
+    }
+  }
+
+  clsf.tax.resize(confs.size());
+  for (Usint i = 0; i < confs.size(); ++i)
+    clsf.tax[i] = model.label(gene, i);
+}
+
+
+// at each level, keep the label with the highest confidence
+static void mergeBest(Clsf &clsf, const Clsf &other) {
+
+  if (clsf.confs.size() < other.confs.size()) {
+    clsf.tax.resize(other.tax.size(), "NA");
+    clsf.confs.resize(other.confs.size(), 0.0);
+  }
+
+  for (Usint i = 0; i < other.confs.size(); ++i) {
+    if (strcmp(other.tax[i], "NA") == 0) continue;
+    if (strcmp(clsf.tax[i], "NA") == 0 || clsf.confs[i] < other.confs[i]) {
+      clsf.tax[i]   = other.tax[i];
+      clsf.confs[i] = other.confs[i];
+    }
+  }
+}
+
+
+// at each level, hits vote for their labels with their bit scores
+// the label with most votes wins, its confidence is the bit score weighted
+// confidence of hits supporting it, relative to the bit scores of all hits
+static void mergeConsensus(const Model &model, const Hit *hits, Uint nhits, Clsf &clsf, VClsf &hclsfs) {
+
+  if (hclsfs.size() < nhits)
+    hclsfs.resize(nhits);
+
+  Usint nconfs = 0;
+  for (Uint h = 0; h < nhits; ++h) {
+    classifyHit(model, hits[h], hclsfs[h]);
+    nconfs = std::max(nconfs, (Usint) hclsfs[h].confs.size());
+  }
+
+  clsf.tax.assign(nconfs, "NA");
+  clsf.confs.assign(nconfs, 0.0);
+  for (Usint i = 0; i < nconfs; ++i) {
+
+    // labels are shared in the model image, so they can be compared as pointers
+    float total = 0.0, bestvote = 0.0;
+    for (Uint h = 0; h < nhits; ++h) {
+      if (i >= hclsfs[h].tax.size() || strcmp(hclsfs[h].tax[i], "NA") == 0) continue;
+      total += hits[h].bit;
+
+      float vote = 0.0, conf = 0.0;
+      for (Uint k = 0; k < nhits; ++k) {
+	if (i < hclsfs[k].tax.size() && hclsfs[k].tax[i] == hclsfs[h].tax[i]) {
+	  vote += hits[k].bit;
+	  conf += hits[k].bit * hclsfs[k].confs[i];
+	}
+      }
+      if (vote > bestvote) {
+	bestvote      = vote;
+	clsf.tax[i]   = hclsfs[h].tax[i];
+	clsf.confs[i] = conf;
+      }
+    }
+    if (total > 0) clsf.confs[i] /= total;
+  }
+}
+
+
+// compute confidence scores at each taxonomic level
+static VF computeConf(const Model &model, Uint gene, Uint len, Uint bit) {
+
+  Usint nlevs = model.genes[gene].nlevs;
+  VF confs(nlevs-1, 0.0);
+
+  const ModelIdx &idx = model.idx[(size_t)gene*model.hdr->nlens + len];
+  if (idx.size == 0 || bit == 0)   // no model, or a hit scoring below any trained one
+    return confs;
+
+  const Usint *scores = model.scores + idx.off;
+  if (bit*nlevs > idx.size) {
+    bit = idx.size / nlevs;
+  }
+  
+  // if score is smaller than biggest score in model
+  // computer conf, otherwise conf is 1
+  for (int i = 0; i < nlevs-1; ++i) { // try to classify at each level
+      
+    Uint samen = 0, diffn = 0;
+    for (int j = 0; j < nlevs; ++j) {
+      size_t loc = (bit-1)*nlevs+j;
+      j <= i ? samen += scores[j] - scores[loc] : diffn += scores[loc];
+    }
+
+    if (samen != 0 || diffn != 0)
+      confs[i] = samen*1.0 / (samen+diffn);
+  }
+
+  return confs;
+}
+
+
+// suppose within a same taxonomic level
+// 10 sequences > 100, and next 20 sequences > 90
+// then we also set values between 90-100 to be 10
+static void setScores(const Taxonomy &tax, const VU &genes, S2VSI &seq2scores) {
+  
+  for (VU::const_iterator giter = genes.begin(); giter != genes.end(); ++giter) {
+    
+    Usint nlevs = tax.nlabs(*giter) + 1;
+    S2VSI::iterator siter = seq2scores.find(tax.geneID(*giter));
+    if (siter == seq2scores.end()) { continue;}
+    for (int i = 0; i < nlevs; ++i) {
+      Uint prenum = 0;
+      for (int j = siter->second.size() - 1 - i; j >= 0 ; j -= nlevs)
+	siter->second[j] != 0 ? prenum = siter->second[j] : siter->second[j] = prenum;
+    }
+  }
+}
+
+
+// store classification scores
+// lencut is set to the shortest HSP of blastx models
+static bool getScores(string scorefile, SI2S2VSI &len2seq2scores, Uint &lencut, string &err) {
+
+  ifstream scorefile_ifs(scorefile.c_str());
+  if (!scorefile_ifs) {
+    err = "Could not open file: " + scorefile;
+    return false;
+  }
+
+  string eachline, seqid, eachword;
+  istringstream iss;
+
+  S2VSI *seq2scores = &len2seq2scores.begin()->second;
+
+  Usint nlevs = 0, lev = 0;
+  S2VSI::iterator siter;
+  while(getline(scorefile_ifs, eachline)) {
+
+    iss.clear();
+    iss.str(eachline);
+
+    if (eachline[0] == '#') {
+
+      // 1st line
+      Usint length = 0;
+      iss >> eachword >> length;
+
+      // 2nd line
+      string blast("");
+      getline(scorefile_ifs, eachline);
+      iss.clear();
+      iss.str(eachline);
+      iss >> eachword >> blast;
+      if (blast == "blastx") {
+	lencut = XLENCUT;
+	length /= 3;
+      }
+  
+      // model with same length has been observed before
+      if (len2seq2scores.find(length) != len2seq2scores.end()) { 
+	ostringstream oss;
+	oss << "Length " << length << " has been observed before at file " << scorefile;
+	err = oss.str();
+	return false;
+      }
+      seq2scores = &len2seq2scores.insert(SI2S2VSI::value_type(length, S2VSI())).first->second;
+
+      // 3rd line
+      getline(scorefile_ifs, eachline); // third line: if this model uses normalization
+      continue;
+    }
+
+    if (eachline.empty()) { // empty line, does not have scores from same taxonomic unit
+      if (lev == 0)         // if it's at the lowest level, then initialize containers
+	siter = seq2scores->insert(S2VSI::value_type(seqid, VSI())).first;
+      ++lev;
+    }
+    
+    else if (eachline[0] == '>') { // this line is a header
+      iss >> seqid >> nlevs;
+      seqid.erase(0, 1);  // extract sequence ID
+      lev = 0;            // set current level to 0
+      nlevs++;            // +1 to accommondate "other" level
+    }
+
+    else { // nonempty line, contains scores
+      Uint score, num;
+      iss >> score >> num;
+
+      if (lev == 0)      // lowest taxonomic level, initialize scores list
+	siter = seq2scores->insert(S2VSI::value_type(seqid, VSI(score*nlevs, 0))).first;
+
+      // if the largest score is bigger than existing one, resize and initialize
+      else{
+	size_t newsize = score*nlevs;
+	size_t oldsize = siter->second.size();
+	if (newsize > oldsize) {
+	  siter->second.resize(newsize);
+	  fill(siter->second.begin()+oldsize, siter->second.end(), 0.0);
+	}
+
+
+      }
+
+      // store all the scores
+      siter->second[(score-1)*nlevs+lev] = num;
+      while(iss >> score >> num)
+	siter->second[(score-1)*nlevs+lev] = num;
+    
+      ++lev; // increase tax level
+    }
+  }
+  return true;
+}
+
+
+// read in taxonomic profile of reference sequences, a database or a text file
+// genes holds gene numbers in ID order, the first of a repeated ID only
+static bool readTaxFile(string taxfile, Taxonomy &tax, VU &genes, string &err) {
+
+  if (tax.read(taxfile, err) <= 0)
+    return false;
+
+  for (Uint i = 0; i < tax.ngenes(); ++i) {
+    Uint gene = tax.sorted(i);
+    if (genes.empty() || strcmp(tax.geneID(genes.back()), tax.geneID(gene)) != 0)
+      genes.push_back(gene);
+  }
+  return true;
+}
+
@@ -0,0 +1,82 @@
+// MetaPhyler classification as a library (libmetaphyler.a): a Classifier
+// loads taxonomy and classification models once, and classifies batches of
+// hits of query reads to reference genes; metaphylerClassify is a command
+// line front end to it.
+//
+//   Classifier clsf;
+//   if (!clsf.load(scorefiles, "markers.taxdb", ""))
+//     cerr << clsf.error() << endl;
+//   n = clsf.classify(hits, nhits, Classifier::FIRST, maxq, first, labels, confs);
+//
+// Errors are returned, never exit the program. classify() does not change
+// the Classifier, so any number of threads can call it at once.
+
+#ifndef METAPHYLER_H
+#define METAPHYLER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// one hit of a query read to a reference gene, as in BLAST -m8 output
+struct ClassifierHit {
+  const char *query;       // read ID; mates of a pair have the same ID
+  const char *ref;         // reference gene ID
+  float       identity;    // % identity
+  unsigned    length;      // alignment length
+  unsigned    bit;         // bit score
+  unsigned    mate;        // 1 or 2 for mates of a read pair, otherwise 0
+};
+
+struct Model;
+
+class Classifier {
+public:
+
+  // how multiple hits of a query are combined:
+  // FIRST, only the top hit (BLAST -b1); BEST, highest confidence at each level;
+  // CONSENSUS, labels voted by bit score at each level
+  enum Combine { FIRST, BEST, CONSENSUS };
+
+  Classifier();
+  ~Classifier();
+
+  // load models of one BLAST program (files from metaphylerTrain) and the
+  // taxonomy labels of reference genes (text, or a taxdb database)
+  // with shmname, the models are shared with other processes on the node:
+  // a POSIX shared memory segment, or an image file if it contains '/'
+  // returns false if they can not be loaded, see error()
+  bool load(const std::vector<std::string> &scorefiles, const std::string &taxfile,
+	    const std::string &shmname = "");
+
+  const std::string &error() const { return err; }
+
+  // most levels of a classification, i.e., the row width of classify() output
+  unsigned nlevels() const;
+
+  // Classify a batch of hits. Hits of a query are consecutive, and hits of
+  // its second mate follow those of the first. For the i-th query (at most
+  // maxqueries), first[i] is its first hit, and labels and confs from
+  // i*nlevels() on are its label and confidence at each level, lowest
+  // first; labels past its last level are NULL, all of them if it is not
+  // classified with confidence at any level. Labels stay valid as long as
+  // the Classifier.
+  // returns the number of queries; used, if given, is set to the number of
+  // hits they take, so the rest of a batch can be classified by another call
+  size_t classify(const ClassifierHit *hits, size_t nhits, Combine combine, size_t maxqueries,
+		  size_t *first, const char **labels, float *confs, size_t *used = NULL) const;
+
+  // keep the label with the higher confidence at each level of two rows of
+  // classify() output, e.g., of blastn and blastx hits of the same read
+  static void mergeBest(const char **labels, float *confs,
+			const char *const *labels2, const float *confs2, unsigned width);
+
+private:
+  Model       *model;
+  std::string err;
+
+  Classifier(const Classifier &);
+  Classifier &operator=(const Classifier &);
+};
+
+#endif
@@ -2,65 +2,97 @@
 using std::cout;
 using std::endl;
 using std::cerr;
+using std::ostream;
 using std::ios_base;
 
 #include <fstream>
 using std::ifstream;
-
-#include <sstream>
-using std::istringstream;
-
-#include <map>
-using std::map;
+using std::ofstream;
+using std::fstream;
 
 #include <vector>
 using std::vector;
 
-#include <set>
-using std::set;
-
 #include <string>
 using std::string;
 
 #include <algorithm>
-#include <functional>
-using std::greater;
 
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 
-#include <utility>
-using std::pair;
+#include <unistd.h>
 
-const float PCTCUT = 50.0;
+#include "hits.h"
+#include "metaphyler.h"
 
 typedef unsigned short int   Usint;
 typedef unsigned int         Uint;
 typedef vector<string>       VS;
-typedef map<string, VS>      S2VS;
-typedef vector<Usint>        VSI;
-typedef map<string, VSI>     S2VSI;
-typedef map<string, Usint>   S2SI;
-typedef map<Usint, S2VSI>    SI2S2VSI;
 typedef vector<float>        VF;
+typedef vector<const char *> VL;
 
-Uint LENCUT = 60;
+const Uint CKPTQUERIES = 100000; // queries between checkpoints
 
 struct Cmdopts{
   VS     scorefiles;
   string taxfile;
   string blastfile;
+  string shmname;    // shared model segment, or image file if it contains '/'
+  Classifier::Combine combine; // how hits of a query are combined
+  VS     matesfx;    // ID suffixes of the two mates of a read pair
+  VS     scorefiles2;
+  string blastfile2; // classified with scorefiles2, merged with blastfile
+  string queryfile;  // order of reads in both BLAST files
+  HitFormat format;  // of BLAST files, from the file names if not given
+  bool   hasformat;
+  string outfile;    // standard output if empty
+  string ckptfile;   // checkpoints of a long run
+  bool   resume;     // continue from the last checkpoint
+};
+
+// how far the input files have been read, and how much output has been
+// written for it; offsets are -1 at the end of a file
+// an interrupted run continues from here, after the output is cut back to
+// the same point, so no query is classified twice
+struct Checkpoint {
+  off_t  output, blast, blast2, query;
+  string qid;        // last read of the query file
+  Uint   nqueries;   // since the last checkpoint
+  bool   resume;     // input is read from these offsets
+};
+
+// reads BLAST output one query at a time
+struct BlastReader {
+  HitFile     file;        // BLAST -m8, or SAM/BAM/PAF turned into -m8 lines
+  string      line;        // first line of next query
+  off_t       linepos;     // its offset in the file
+  bool        more;        // line is valid
+  Classifier::Combine combine;
+  const VS    *matesfx;
+  VS          rids;        // reference IDs of hits of current query
+  vector<ClassifierHit> hits; // hits of current query, reused for every query
 };
 
 void helpmsg();
 void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
-void readTaxFile(string taxfile, S2VS &seq2tax, S2SI &seq2nlevs);
-void getScores(string scorefile, SI2S2VSI &len2seq2scores);
-void setScores(S2SI &seq2nlevs, S2VSI &seq2scores);
-void classifyBLAST(string blastfile, S2SI &seq2nlevs, SI2S2VSI &len2seq2scores, S2VS &seq2tax);
-VF   computeConf(string rid, Uint bit, Usint nlevs, S2VSI &seq2scores);
-void printSeq2Scores(S2SI &seq2nlevs, S2VSI &seq2scores);
-void printClassification(const VF& confs, const VS& tax, const string qid);
-inline float average(const VF &ary);
+VS   splitList(const string &filestr);
+void loadModel(const VS &scorefiles, const string &taxfile, const string &shmname, Classifier &classifier);
+void classifyBLAST(string blastfile, const Classifier &classifier, const Cmdopts &cmdopts, Checkpoint &ckpt, ostream &out);
+void classifyJoint(const Cmdopts &cmdopts, const Classifier &classifier, const Classifier &classifier2, Checkpoint &ckpt, ostream &out);
+bool readCheckpoint(const string &ckptfile, Checkpoint &ckpt);
+void writeCheckpoint(const Cmdopts &cmdopts, Checkpoint &ckpt, ostream &out);
+off_t lineStart(BlastReader &reader);
+void seekBLAST(BlastReader &reader, off_t pos);
+bool atQuery(const BlastReader &reader, const string &qid);
+void openBLAST(string blastfile, const Cmdopts &cmdopts, BlastReader &reader);
+bool nextLine(BlastReader &reader);
+size_t fragmentKey(const string &eachline, size_t pos1, const VS &matesfx, Usint &mate);
+bool nextQuery(BlastReader &reader, string &qid);
+void parseHit(const string &eachline, size_t pos1, string &rid, ClassifierHit &hit);
+bool classifyQuery(const Classifier &classifier, const BlastReader &reader, VL &labels, VF &confs);
+void printClassification(ostream &out, const VL &labels, const VF &confs, const string qid);
 
 
 int main(int argc, char *argv[]) {
@@ -70,311 +102,464 @@ int main(int argc, char *argv[]) {
   getcmdopts(argc, argv, cmdopts);
 
 
-  // read in taxonomic labels for each reference gene
-  S2VS  seq2tax;
-  S2SI  seq2nlevs;
-  readTaxFile(cmdopts.taxfile, seq2tax, seq2nlevs);
+  // load models, or attach to a copy shared by other processes
+  Classifier classifier;
+  loadModel(cmdopts.scorefiles, cmdopts.taxfile, cmdopts.shmname, classifier);
 
-  
-  // read in cutoff file
-  SI2S2VSI len2seq2scores;
-  S2VSI seq2scores;
-  for (VS::const_iterator citer = cmdopts.scorefiles.begin(); citer != cmdopts.scorefiles.end(); ++citer) {
-    getScores(*citer, len2seq2scores);
-  }
 
-  // prepare for classification
-  for (SI2S2VSI::iterator citer = len2seq2scores.begin(); citer != len2seq2scores.end(); ++citer) {
-    setScores(seq2nlevs, citer->second);
-    //printSeq2Scores(seq2nlevs, citer->second);
+  // when resuming, output after the last checkpoint is discarded
+  Checkpoint ckpt = {0, 0, 0, 0, "", 0, false};
+  ckpt.resume = cmdopts.resume && readCheckpoint(cmdopts.ckptfile, ckpt);
+  fstream ofs;
+  if (!cmdopts.outfile.empty()) {
+    if (ckpt.resume && truncate(cmdopts.outfile.c_str(), ckpt.output) != 0) {
+      cerr << "Could not resume file " << cmdopts.outfile << endl;
+      exit(1);
+    }
+    ofs.open(cmdopts.outfile.c_str(), ckpt.resume ? fstream::in | fstream::out : fstream::out | fstream::trunc);
+    if (!ofs) {
+      cerr << "Could not open file " << cmdopts.outfile << endl;
+      exit(1);
+    }
+    ofs.seekp(0, fstream::end);
   }
+  ostream &out = cmdopts.outfile.empty() ? cout : ofs;
 
   
-  classifyBLAST(cmdopts.blastfile, seq2nlevs, len2seq2scores, seq2tax);
+  if (cmdopts.blastfile2.empty())
+    classifyBLAST(cmdopts.blastfile, classifier, cmdopts, ckpt, out);
+
+  // second set of models for the second BLAST file, e.g., blastn and blastx
+  else {
+    Classifier classifier2;
+    loadModel(cmdopts.scorefiles2, cmdopts.taxfile, cmdopts.shmname.empty() ? "" : cmdopts.shmname + "_2", classifier2);
+    classifyJoint(cmdopts, classifier, classifier2, ckpt, out);
+  }
   
   return 0;
 }
 
+// load models, or attach to a copy shared by other processes
+void loadModel(const VS &scorefiles, const string &taxfile, const string &shmname, Classifier &classifier) {
 
-// the average of an array
-inline float average(const VF &ary) {
-  float ave = 0;
-  for (VF::const_iterator citer = ary.begin(); citer != ary.end(); ++citer)
-    ave += *citer;
-  return ave/ary.size();
+  if (!classifier.load(scorefiles, taxfile, shmname)) {
+    cerr << classifier.error() << endl;
+    exit(1);
+  }
 }
 
 
 // read BLAST file, classify query reads
-void classifyBLAST(string blastfile, S2SI &seq2nlevs, SI2S2VSI &len2seq2scores, S2VS &seq2tax) {
+// hits of a query are consecutive in BLAST output, so they are collected
+// in one buffer and classified together once the next query starts
+void classifyBLAST(string blastfile, const Classifier &classifier, const Cmdopts &cmdopts, Checkpoint &ckpt, ostream &out) {
+
+  BlastReader reader;
+  openBLAST(blastfile, cmdopts, reader);
+  if (ckpt.resume)
+    seekBLAST(reader, ckpt.blast);
+
+  string qid;
+  VL     labels(classifier.nlevels());  // classification of current query
+  VF     confs(labels.size());
+  while (nextQuery(reader, qid)) {
+    if (classifyQuery(classifier, reader, labels, confs))
+      printClassification(out, labels, confs, qid);
+
+    if (!cmdopts.ckptfile.empty() && ++ckpt.nqueries == CKPTQUERIES) {
+      ckpt.blast = lineStart(reader);
+      writeCheckpoint(cmdopts, ckpt, out);
+    }
+  }
 
-  ifstream blastfile_ifs(blastfile.c_str());
-  if (!blastfile_ifs) {
-    cerr << "Could not open file: " << blastfile << endl;
+  if (!cmdopts.ckptfile.empty()) {
+    ckpt.blast = -1;
+    writeCheckpoint(cmdopts, ckpt, out);
+  }
+}
+
+
+// read two BLAST files of the same query reads (e.g., blastn and blastx)
+// together, each classified with its own models, and merge classifications
+// of a read by keeping the best confidence at each level
+// reads are visited in the order of the query file, which both BLAST files follow
+void classifyJoint(const Cmdopts &cmdopts, const Classifier &classifier, const Classifier &classifier2, Checkpoint &ckpt, ostream &out) {
+
+  BlastReader reader, reader2;
+  openBLAST(cmdopts.blastfile,  cmdopts, reader);
+  openBLAST(cmdopts.blastfile2, cmdopts, reader2);
+
+  ifstream ifs(cmdopts.queryfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file: " << cmdopts.queryfile << endl;
     exit(1);
   }
 
+  string eachline, id, qid = ckpt.qid, rqid;
+  if (ckpt.resume) {
+    seekBLAST(reader,  ckpt.blast);
+    seekBLAST(reader2, ckpt.blast2);
+    if (ckpt.query < 0)
+      ifs.setstate(ifstream::eofbit);
+    else
+      ifs.seekg(ckpt.query);
+  }
 
-  string      eachline;
-  set<string> seqids;   // keeps sequences that have been processed
-  while (getline(blastfile_ifs, eachline)) {
+  Uint   width = std::max(classifier.nlevels(), classifier2.nlevels());
+  VL     labels(width), labels2(width);
+  VF     confs(width), confs2(width);
+  Usint  mate;
+  while (getline(ifs, eachline)) {
 
-    // get query read ID
-    size_t pos1 = eachline.find("\t");
-    string qid  = eachline.substr(0, pos1);
-    if (seqids.find(qid) != seqids.end()) continue; // has been processed
-    seqids.insert(qid);
-
-    // get reference sequence ID
-    size_t pos2 = eachline.find("\t", pos1+1);
-    string rid  = eachline.substr(pos1+1, pos2-pos1-1);
-    S2SI::const_iterator s2si_citer = seq2nlevs.find(rid);
-    if (s2si_citer == seq2nlevs.end()) continue; // does not have classifier for it
-    Usint nlevs = s2si_citer->second;
-    if (seq2tax.find(rid) == seq2tax.end()) continue;     // does not have taxonomic label
-
-    // get % identity
-    size_t pos3 = eachline.find("\t", pos2+1);
-    float  pct  = atof(eachline.substr(pos2+1, pos3-pos2-1).c_str());
-    if (pct < PCTCUT) continue;
-
-    // HSP length
-    size_t pos4 = eachline.find("\t", pos3+1);
-    Usint  hsp  = atoi(eachline.substr(pos3+1, pos4-pos3-1).c_str());
-    if (hsp < LENCUT) continue;
-
-    // get bit score
-    size_t pos5     = eachline.rfind(" ") != string::npos ? eachline.rfind(" ") : eachline.rfind("\t"); // sometimes an extract space before bit score
-    Uint bit = atoi(eachline.substr(pos5+1, eachline.size()-pos5-1).c_str());
-
-
-    VF confs; // confidence scores at each level
-
-    // if hsp length is smaller than the shortest length from available models,
-    // then use it, but do not scale bit socre
-    if (hsp < len2seq2scores.begin()->first)
-      confs = computeConf(rid, bit, nlevs, len2seq2scores.begin()->second);
-
-    // if hsp length is bigger than the longest length from available models,
-    // then use it, scale the bit score according to length
-    else if (hsp > len2seq2scores.rbegin()->first)
-      confs = computeConf(rid, bit*(len2seq2scores.rbegin()->first)/hsp, nlevs, len2seq2scores.rbegin()->second);
-
-    else {
-
-      // iterate through all models for different read lengths
-      // suppose hsp length is 150bp; we have models for 100bp and 200 bp
-      // then we try classification using both models,
-      // and use the one with higher average confidence score
-      for (SI2S2VSI::iterator citer = len2seq2scores.begin(); citer != len2seq2scores.end(); ++citer) {
-
-	if (hsp == citer->first) { // if exactly the same, then just use this model
-	  confs = computeConf(rid, bit, nlevs, citer->second);
-	  break;
-	}
-	
-	else if (hsp < citer->first) {
-	  confs = computeConf(rid, bit, nlevs, citer->second);
-	  VF confs2 = computeConf(rid, bit*(citer->first)/hsp, nlevs, (--citer)->second);
-	  if (average(confs) < average(confs2)) confs = confs2;
-	  break;
-	}
-      }
+    if (eachline.empty() || eachline[0] != '>') continue;
+
+    // mates of a pair are one query
+    size_t pos1 = eachline.find_first_of(" \t");
+    id.assign(eachline, 1, pos1 == string::npos ? string::npos : pos1-1);
+    size_t klen = fragmentKey(id, id.size(), cmdopts.matesfx, mate);
+    if (klen == qid.size() && id.compare(0, klen, qid) == 0) continue;
+    qid.assign(id, 0, klen);
+
+    bool found = false, found2 = false;
+    if (atQuery(reader, qid)) {
+      nextQuery(reader, rqid);
+      found = classifyQuery(classifier, reader, labels, confs);
+    }
+    if (atQuery(reader2, qid)) {
+      nextQuery(reader2, rqid);
+      found2 = classifyQuery(classifier2, reader2, labels2, confs2);
+    }
+
+    if (found && found2)
+      Classifier::mergeBest(&labels[0], &confs[0], &labels2[0], &confs2[0], width);
+    else if (found2) {
+      labels.swap(labels2);
+      confs.swap(confs2);
+    }
+
+    if (found || found2)
+      printClassification(out, labels, confs, qid);
+
+    if (!cmdopts.ckptfile.empty() && ++ckpt.nqueries == CKPTQUERIES) {
+      ckpt.blast  = lineStart(reader);
+      ckpt.blast2 = lineStart(reader2);
+      ckpt.query  = ifs.tellg();
+      ckpt.qid    = qid;
+      writeCheckpoint(cmdopts, ckpt, out);
     }
-    if (*max_element(confs.begin(), confs.end()) >= 0.001)
-      printClassification(confs, seq2tax.find(rid)->second, qid);
   }
-}
 
+  if (!cmdopts.ckptfile.empty()) {
+    ckpt.blast = ckpt.blast2 = ckpt.query = -1;
+    ckpt.qid   = qid;
+    writeCheckpoint(cmdopts, ckpt, out);
+  }
 
-// print out classification information
-void printClassification(const VF& confs, const VS& tax, const string qid) {
-
-  cout.setf(ios_base::fixed);
-  cout.precision(3);
-  cout << qid << "\t";
-  for (Usint i = 0; i < confs.size(); ++i) {
-    if (tax[i] == "NA") 
-      cout << tax[i] << "\t";
-    else
-      cout << tax[i] << "(" << confs[i] << ")\t";
+  if (reader.more || reader2.more) {
+    cerr << "BLAST files do not follow the order of reads in " << cmdopts.queryfile << endl;
+    exit(1);
   }
-  cout << endl;
 }
 
 
-// compute confidence scores at each taxonomic level
-VF computeConf(string rid, Uint bit, Usint nlevs, S2VSI &seq2scores) {
+// read in the last checkpoint, false if there is none
+bool readCheckpoint(const string &ckptfile, Checkpoint &ckpt) {
+
+  ifstream ifs(ckptfile.c_str());
+  if (!ifs) return false;
+
+  string key, eachline;
+  while (getline(ifs, eachline)) {
+    size_t pos = eachline.find('\t');
+    if (pos == string::npos) continue;
+    key = eachline.substr(0, pos);
+    const char *value = eachline.c_str() + pos + 1;
+    if      (key == "output") ckpt.output = atoll(value);
+    else if (key == "blast")  ckpt.blast  = atoll(value);
+    else if (key == "blast2") ckpt.blast2 = atoll(value);
+    else if (key == "query")  ckpt.query  = atoll(value);
+    else if (key == "qid")    ckpt.qid    = value;
+  }
+  return true;
+}
 
-  VF confs(nlevs-1, 0.0);
 
-  if (seq2scores.find(rid) == seq2scores.end())
-    return confs;
+// flush output, and record how far input has been read for it;
+// the new checkpoint replaces the old one only once it is complete
+void writeCheckpoint(const Cmdopts &cmdopts, Checkpoint &ckpt, ostream &out) {
 
-  VSI &scores = seq2scores.find(rid)->second;
-  if (scores.empty())
-    return confs;
+  out.flush();
+  ckpt.output   = out.tellp();
+  ckpt.nqueries = 0;
 
-  if (bit*nlevs > scores.size()) {
-    bit = scores.size() / nlevs;
+  string tmpfile = cmdopts.ckptfile + ".tmp";
+  ofstream ofs(tmpfile.c_str());
+  ofs << "output\t" << ckpt.output << "\n"
+      << "blast\t"  << ckpt.blast  << "\n"
+      << "blast2\t" << ckpt.blast2 << "\n"
+      << "query\t"  << ckpt.query  << "\n"
+      << "qid\t"    << ckpt.qid    << "\n";
+  ofs.close();
+
+  if (!out || !ofs || rename(tmpfile.c_str(), cmdopts.ckptfile.c_str()) != 0) {
+    cerr << "Could not write checkpoint " << cmdopts.ckptfile << endl;
+    exit(1);
   }
-  
-  // if score is smaller than biggest score in model
-  // computer conf, otherwise conf is 1
-  for (int i = 0; i < nlevs-1; ++i) { // try to classify at each level
-      
-    Uint samen = 0, diffn = 0;
-    for (int j = 0; j < nlevs; ++j) {
-      size_t loc = (bit-1)*nlevs+j;
-      j <= i ? samen += scores[j] - scores[loc] : diffn += scores[loc];
-    }
+}
+
+
+// offset of the first line of next query in a BLAST file, -1 at the end
+off_t lineStart(BlastReader &reader) {
+
+  if (!reader.more) return -1;
 
-    if (samen != 0 || diffn != 0)
-      confs[i] = samen*1.0 / (samen+diffn);
+  return reader.linepos;
+}
+
+
+// continue reading a BLAST file at the given offset
+void seekBLAST(BlastReader &reader, off_t pos) {
+
+  if (pos < 0) {
+    reader.more = false;
+    return;
   }
+  reader.file.seek(pos);
+  nextLine(reader);
+}
+
+
+// if next query in BLAST file is the given read
+bool atQuery(const BlastReader &reader, const string &qid) {
 
-  return confs;
+  if (!reader.more) return false;
+
+  Usint  mate;
+  size_t pos1 = reader.line.find("\t");
+  size_t klen = fragmentKey(reader.line, pos1, *reader.matesfx, mate);
+  return klen == qid.size() && reader.line.compare(0, klen, qid) == 0;
 }
 
 
-// suppose within a same taxonomic level
-// 10 sequences > 100, and next 20 sequences > 90
-// then we also set values between 90-100 to be 10
-void setScores(S2SI &seq2nlevs, S2VSI &seq2scores) {
-  
-  for (S2SI::iterator citer = seq2nlevs.begin(); citer != seq2nlevs.end(); ++citer) {
-    
-    Usint nlevs = citer->second;
-    S2VSI::iterator siter = seq2scores.find(citer->first);
-    if (siter == seq2scores.end()) { continue;}
-    for (int i = 0; i < nlevs; ++i) {
-      Uint prenum = 0;
-      for (int j = siter->second.size() - 1 - i; j >= 0 ; j -= nlevs)
-	siter->second[j] != 0 ? prenum = siter->second[j] : siter->second[j] = prenum;
-    }
+// open BLAST file for reading one query at a time
+void openBLAST(string blastfile, const Cmdopts &cmdopts, BlastReader &reader) {
+
+  HitFormat format = cmdopts.hasformat ? cmdopts.format : hitFormat(blastfile);
+  if (format == BAM && !cmdopts.ckptfile.empty()) {
+    cerr << "Checkpoints need a file that can be read from an offset, not BAM: " << blastfile << endl;
+    exit(1);
+  }
+  if (!reader.file.open(blastfile, format, cmdopts.matesfx)) {
+    cerr << "Could not open file: " << blastfile << endl;
+    exit(1);
   }
+  if (reader.file.bycoord) {
+    cerr << "Hits of a read must be next to each other, but " << blastfile << " is sorted by coordinate;" << endl;
+    cerr << "use name-sorted or collated input (samtools sort -n, samtools collate)" << endl;
+    exit(1);
+  }
+  reader.combine = cmdopts.combine;
+  reader.matesfx = &cmdopts.matesfx;
+  nextLine(reader);
 }
 
 
-// store classification scores
-void getScores(string scorefile, SI2S2VSI &len2seq2scores) {
+// read the next hit; blank and comment lines, which HitFile passes through
+// from -m8 files, have no tab and are skipped
+bool nextLine(BlastReader &reader) {
 
-  ifstream scorefile_ifs(scorefile.c_str());
-  if (!scorefile_ifs) {
-    cerr << "Could not open file: " << scorefile << endl;
+  while ((reader.more = reader.file.next(reader.line, reader.linepos)))
+    if (reader.line.find('\t') != string::npos) break;
+  if (reader.file.failed) {
+    cerr << "Could not read file " << reader.file.name << endl;
     exit(1);
   }
+  return reader.more;
+}
 
-  string eachline, seqid, eachword;
-  istringstream iss;
 
-  S2VSI *seq2scores = &len2seq2scores.begin()->second;
+// length of query ID without mate suffix, and which mate it is (0 if unpaired)
+size_t fragmentKey(const string &eachline, size_t pos1, const VS &matesfx, Usint &mate) {
 
-  Usint nlevs = 0, lev = 0;
-  S2VSI::iterator siter;
-  while(getline(scorefile_ifs, eachline)) {
+  mate = 0;
+  if (pos1 == string::npos) return eachline.size();
+  for (Usint i = 0; i < matesfx.size(); ++i) {
+    const string &sfx = matesfx[i];
+    if (pos1 > sfx.size() && eachline.compare(pos1-sfx.size(), sfx.size(), sfx) == 0) {
+      mate = i + 1;
+      return pos1 - sfx.size();
+    }
+  }
+  return pos1;
+}
 
-    iss.clear();
-    iss.str(eachline);
 
-    if (eachline[0] == '#') {
+// collect all hits of next query; mates of a pair are one query
+// returns false at the end of the file
+bool nextQuery(BlastReader &reader, string &qid) {
 
-      // 1st line
-      Usint length = 0;
-      iss >> eachword >> length;
+  if (!reader.more) return false;
 
-      // 2nd line
-      string blast("");
-      getline(scorefile_ifs, eachline);
-      iss.clear();
-      iss.str(eachline);
-      iss >> eachword >> blast;
-      if (blast == "blastx") {
-	LENCUT = 20;
-	length /= 3;
-      }
-  
-      // model with same length has been observed before
-      if (len2seq2scores.find(length) != len2seq2scores.end()) { 
-	cerr << "Length " << length << " has been observed before at file " << scorefile << endl;
-	exit(1);
-      }
-      seq2scores = &len2seq2scores.insert(SI2S2VSI::value_type(length, S2VSI())).first->second;
-
-      // 3rd line
-      getline(scorefile_ifs, eachline); // third line: if this model uses normalization
-      continue;
-    }
+  vector<ClassifierHit> &hits = reader.hits;
+  hits.clear();
+  Usint mate, curmate = 0;
+  bool  done = false;   // current read needs no more hits
+  for (bool first = true; ; first = false) {
 
-    if (eachline.empty()) { // empty line, does not have scores from same taxonomic unit
-      if (lev == 0)         // if it's at the lowest level, then initialize containers
-	siter = seq2scores->insert(S2VSI::value_type(seqid, VSI())).first;
-      ++lev;
+    // get query read ID
+    string &eachline = reader.line;
+    size_t pos1 = eachline.find("\t");
+    size_t klen = fragmentKey(eachline, pos1, *reader.matesfx, mate);
+    if (first)
+      qid.assign(eachline, 0, klen);
+    else if (klen != qid.size() || eachline.compare(0, klen, qid) != 0)
+      break;            // next query starts
+
+    if (first || mate != curmate) {
+      curmate = mate;
+      done    = false;
     }
-    
-    else if (eachline[0] == '>') { // this line is a header
-      iss >> seqid >> nlevs;
-      seqid.erase(0, 1);  // extract sequence ID
-      lev = 0;            // set current level to 0
-      nlevs++;            // +1 to accommondate "other" level
+
+    if (!done) {
+      done = reader.combine == Classifier::FIRST;
+      if (reader.rids.size() == hits.size())
+	reader.rids.push_back("");
+      ClassifierHit hit;
+      parseHit(eachline, pos1, reader.rids[hits.size()], hit);
+      hit.mate = mate;
+      hits.push_back(hit);
     }
 
-    else { // nonempty line, contains scores
-      Uint score, num;
-      iss >> score >> num;
+    if (!nextLine(reader))
+      break;
+  }
 
-      if (lev == 0)      // lowest taxonomic level, initialize scores list
-	siter = seq2scores->insert(S2VSI::value_type(seqid, VSI(score*nlevs, 0))).first;
+  // IDs are in place only now, as rids may have grown
+  for (size_t h = 0; h < hits.size(); ++h) {
+    hits[h].query = qid.c_str();
+    hits[h].ref   = reader.rids[h].c_str();
+  }
+  return true;
+}
 
-      // if the largest score is bigger than existing one, resize and initialize
-      else{
-	size_t newsize = score*nlevs;
-	size_t oldsize = siter->second.size();
-	if (newsize > oldsize) {
-	  siter->second.resize(newsize);
-	  fill(siter->second.begin()+oldsize, siter->second.end(), 0.0);
-	}
 
+// parse one line of BLAST output
+void parseHit(const string &eachline, size_t pos1, string &rid, ClassifierHit &hit) {
 
-      }
+  // get reference sequence ID
+  size_t pos2 = eachline.find("\t", pos1+1);
+  rid.assign(eachline, pos1+1, pos2-pos1-1);
 
-      // store all the scores
-      siter->second[(score-1)*nlevs+lev] = num;
-      while(iss >> score >> num)
-	siter->second[(score-1)*nlevs+lev] = num;
-    
-      ++lev; // increase tax level
-    }
-  }
+  // get % identity
+  size_t pos3  = eachline.find("\t", pos2+1);
+  hit.identity = atof(eachline.substr(pos2+1, pos3-pos2-1).c_str());
+
+  // HSP length
+  size_t pos4  = eachline.find("\t", pos3+1);
+  hit.length   = atoi(eachline.substr(pos3+1, pos4-pos3-1).c_str());
+
+  // get bit score
+  hit.bit      = m8Bits(eachline);
+}
+
+
+// classify the hits of a query read by nextQuery
+// returns true if it is classified with confidence at any level
+bool classifyQuery(const Classifier &classifier, const BlastReader &reader, VL &labels, VF &confs) {
+
+  std::fill(labels.begin(), labels.end(), (const char *) NULL);
+  if (reader.hits.empty() || labels.empty()) return false;
+
+  size_t first;
+  classifier.classify(&reader.hits[0], reader.hits.size(), reader.combine, 1, &first, &labels[0], &confs[0]);
+  return labels[0] != NULL;
 }
 
 
+// print out classification information
+void printClassification(ostream &out, const VL &labels, const VF &confs, const string qid) {
+
+  out.setf(ios_base::fixed);
+  out.precision(3);
+  out << qid << "\t";
+  for (Usint i = 0; i < labels.size() && labels[i]; ++i) {
+    if (strcmp(labels[i], "NA") == 0)
+      out << labels[i] << "\t";
+    else
+      out << labels[i] << "(" << confs[i] << ")\t";
+  }
+  out << endl;
+}
+
 // parse command line options
 void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
 
-  if (argc != 4) {
+  cmdopts.combine = Classifier::FIRST;
+  cmdopts.resume  = false;
+  cmdopts.hasformat = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:c:p:q:o:k:rf:")) != -1) {
+    switch (opt) {
+    case 'f':
+      if (!hitFormat(optarg, cmdopts.format)) { helpmsg(); exit(1); }
+      cmdopts.hasformat = true;
+      break;
+    case 'm': cmdopts.shmname = optarg; break;
+    case 'o': cmdopts.outfile  = optarg; break;
+    case 'k': cmdopts.ckptfile = optarg; break;
+    case 'r': cmdopts.resume   = true; break;
+    case 'c':
+      if      (string(optarg) == "first")     cmdopts.combine = Classifier::FIRST;
+      else if (string(optarg) == "best")      cmdopts.combine = Classifier::BEST;
+      else if (string(optarg) == "consensus") cmdopts.combine = Classifier::CONSENSUS;
+      else { helpmsg(); exit(1); }
+      break;
+    case 'p':
+      cmdopts.matesfx = splitList(optarg);
+      if (cmdopts.matesfx.size() != 2) { helpmsg(); exit(1); }
+      break;
+    case 'q': cmdopts.queryfile = optarg; break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+
+  if ((argc - optind != 3 && argc - optind != 5) || (argc - optind == 5 && cmdopts.queryfile.empty())
+      || (!cmdopts.ckptfile.empty() && cmdopts.outfile.empty()) || (cmdopts.resume && cmdopts.ckptfile.empty())) {
     helpmsg();
     exit(1);
   }
+  if (argc - optind == 5) {
+    cmdopts.scorefiles2 = splitList(argv[optind+3]);
+    cmdopts.blastfile2  = argv[optind+4];
+  }
+  argv += optind - 1;
 
   cmdopts.taxfile   = argv[2];
   cmdopts.blastfile = argv[3];
 
   
   // could be multiple files
-  string filestr = argv[1]; 
+  cmdopts.scorefiles = splitList(argv[1]);
+}
+
+
+// split a comma separated list, e.g., fileA,fileB
+VS splitList(const string &filestr) {
+
+  VS     items;
   size_t prepos  = 0;
-  for (Usint i = 0; i < filestr.size(); ++i) {
+  for (Uint i = 0; i < filestr.size(); ++i) {
     if (filestr[i] == ',') {
-      cmdopts.scorefiles.push_back(filestr.substr(prepos, i-prepos));
+      items.push_back(filestr.substr(prepos, i-prepos));
       prepos = i + 1;
     }
   }
 
   // if input files string is "A,B,", then no need to store last record.
-  if (filestr[filestr.size()-1] != ',') 
-    cmdopts.scorefiles.push_back(filestr.substr(prepos, filestr.size()-prepos));
-  
+  if (!filestr.empty() && filestr[filestr.size()-1] != ',') 
+    items.push_back(filestr.substr(prepos, filestr.size()-prepos));
+  return items;
 }
 
 
@@ -383,72 +568,61 @@ void helpmsg() {
   cerr << endl;
 
   cerr << "Usage:" << endl;
-  cerr << "        ./metaphylerClassify <classifiers> <taxonomy file> <BLAST file>" << endl;
+  cerr << "        ./metaphylerClassify [options] <classifiers> <taxonomy file> <BLAST file>" << endl;
+  cerr << "        ./metaphylerClassify [options] -q <query> <classifiers> <taxonomy file> <BLAST file> <classifiers 2> <BLAST file 2>" << endl;
   cerr << endl;
 
   cerr << "Options:" << endl;
   cerr << "      <classifiers>   Output from program blast2TaxScores." << endl;
   cerr << "                      If there are multiple files, separate them with comma(e.g., fileA,fileB)" << endl << endl;
 
-  cerr << "      <taxonomy file> Taxonomy labels of reference sequences in the BLAST file." << endl << endl;
+  cerr << "      <taxonomy file> Taxonomy labels of reference sequences in the BLAST file," << endl;
+  cerr << "                      or a database compiled from them by taxdb." << endl << endl;
 
-  cerr << "      <BLAST file>    BLAST alignment between query reads and reference sequences." << endl << endl;
+  cerr << "      <BLAST file>    BLAST alignment between query reads and reference sequences." << endl;
+  cerr << "                      Also SAM, BAM (read with samtools) or PAF from a read mapper, by file name" << endl;
+  cerr << "                      (.sam, .bam, .paf) or -f. Their bit scores are computed with blastn scores" << endl;
+  cerr << "                      (1/-3, gaps 5/2), as in training. Protein hits must be BLAST -m8." << endl;
+  cerr << "                      Hits of a read must be next to each other: SAM and BAM must be" << endl;
+  cerr << "                      name-sorted or collated (samtools sort -n, samtools collate)," << endl;
+  cerr << "                      not sorted by coordinate." << endl << endl;
 
-  
-  cerr << "Contact:" << endl;
-  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
-  cerr << endl;
+  cerr << "      <classifiers 2> <BLAST file 2>" << endl;
+  cerr << "                      Second BLAST file of the same reads and its classifiers (e.g., blastx)." << endl;
+  cerr << "                      Both files are read together, and each read is reported once" << endl;
+  cerr << "                      with the best confidence at each level." << endl << endl;
 
-}
+  cerr << "      -q <query>      Query reads in FASTA format; both BLAST files follow their order." << endl << endl;
 
+  cerr << "      -f <format>     Format of BLAST files: m8, sam, bam or paf." << endl << endl;
 
-// read in taxonomic profile of reference sequences
-void readTaxFile(string taxfile, S2VS &seq2tax, S2SI &seq2nlevs) {
+  cerr << "      -c <mode>       How to combine multiple hits of a query (BLAST -b > 1)." << endl;
+  cerr << "                      first:     only the top hit (default)." << endl;
+  cerr << "                      best:      highest confidence at each level." << endl;
+  cerr << "                      consensus: at each level, labels are voted by bit score of the hits." << endl << endl;
 
-  ifstream ifs(taxfile.c_str());
-  if (!ifs) {
-    cerr << "Could not open file " << taxfile << endl;
-    exit(1);
-  }
+  cerr << "      -p <sfx1,sfx2>  Read IDs ending with these suffixes are mates of a pair (e.g., /1,/2)." << endl;
+  cerr << "                      Their hits are merged, and each pair is reported once without the suffix." << endl;
+  cerr << "                      Mates must be next to each other in the BLAST file (interleaved query)." << endl << endl;
 
-  istringstream iss;
-  string eachline;
-  while (getline(ifs, eachline)) {
+  cerr << "      -m <name>       Share the loaded models between processes on this node." << endl;
+  cerr << "                      The first process publishes them in POSIX shared memory segment <name>," << endl;
+  cerr << "                      later ones attach to it instead of loading their own copy." << endl;
+  cerr << "                      If <name> contains '/', a model image file is written and mapped instead." << endl;
+  cerr << "                      The segment stays until removed (rm /dev/shm/<name>)." << endl << endl;
 
-    iss.clear();
-    iss.str(eachline);
-
-    string seqid;
-    iss >> seqid;          // 1st column is sequence ID
-    
-    VS tlabs;
-    string eachword;
-    while(iss >> eachword) // other columns are taxonomic IDs 
-      tlabs.push_back(eachword);
-    seq2tax.insert(S2VS::value_type(seqid, tlabs));
-    seq2nlevs.insert(S2SI::value_type(seqid, tlabs.size()+1));
-  }
-}
+  cerr << "      -o <output>     Write classifications to this file instead of standard output." << endl << endl;
+
+  cerr << "      -k <checkpoint> Every " << CKPTQUERIES << " queries, record in this file how far the input" << endl;
+  cerr << "                      has been read and how much output has been written (requires -o)." << endl << endl;
 
+  cerr << "      -r              Resume an interrupted run from the checkpoint given with -k." << endl;
+  cerr << "                      Output after the checkpoint is discarded, and classified again." << endl << endl;
 
-// for debuging purposes
-void printSeq2Scores(S2SI &seq2nlevs, S2VSI &seq2scores) {
   
-  for (S2SI::const_iterator citer = seq2nlevs.begin(); citer != seq2nlevs.end(); ++citer) {
-    Usint nlevs = citer->second;
-
-    S2VSI::const_iterator siter = seq2scores.find(citer->first);
-    if (siter == seq2scores.end()) { continue;}
-    cout << citer->first << "\t" << siter->second.size() << endl;
-
-    for (Uint i = 0; i < nlevs; ++i) {
-      for (Uint j = i; j < siter->second.size(); j += nlevs) {
-	if (siter->second[j] > 0)
-	  cout << j / nlevs + 1 << "\t" << siter->second[j] << "\t";
-      }
-      cout << endl;
-    }
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
 
-  }
 }
 
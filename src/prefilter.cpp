@@ -0,0 +1,253 @@
+// Keep only reads that share k-mers with marker genes, so that reads from
+// other genes are not sent to BLAST
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <cstdlib>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "kmer.h"
+
+const Uint BATCHSIZE = 20000;   // reads per thread in a batch
+
+struct Cmdopts {
+  string markerfile,
+	 queryfile;
+  Uint   k,
+	 minhits,
+	 bitsper,
+	 nthreads;
+  bool   protein;        // markers are proteins, reads are translated (blastx)
+};
+
+// work of one thread: marker sequences to index, or reads to check
+struct Job {
+  const Cmdopts     *cmdopts;
+  BloomFilter       *index;
+  vector<SeqRecord> *recs;
+  vector<char>      *keep;
+  size_t            begin, end;
+};
+
+void helpmsg();
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
+void buildIndex(const Cmdopts &cmdopts, BloomFilter &index);
+void filterReads(const Cmdopts &cmdopts, BloomFilter &index);
+void runJobs(const Cmdopts &cmdopts, BloomFilter &index, vector<SeqRecord> &recs, size_t n, vector<char> *keep);
+void *indexJob(void *arg);
+void *filterJob(void *arg);
+void printRecord(const SeqRecord &rec);
+
+
+int main(int argc, char *argv[]) {
+
+  // read in command line options
+  Cmdopts cmdopts;
+  getcmdopts(argc, argv, cmdopts);
+
+
+  // k-mers of all marker genes
+  BloomFilter index;
+  buildIndex(cmdopts, index);
+
+
+  // print out reads that share enough k-mers with markers
+  filterReads(cmdopts, index);
+
+  return 0;
+}
+
+
+// insert k-mers of all marker genes into a Bloom filter
+void buildIndex(const Cmdopts &cmdopts, BloomFilter &index) {
+
+  ifstream ifs(cmdopts.markerfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.markerfile << endl;
+    exit(1);
+  }
+
+  vector<SeqRecord> recs;
+  SeqRecord rec;
+  SeqReader reader(ifs);
+  uint64_t  nkmers = 0;
+  while (reader.next(rec)) {
+    nkmers += rec.seq.size();
+    recs.push_back(rec);
+  }
+  index.init(nkmers, cmdopts.bitsper, 8);
+
+  runJobs(cmdopts, index, recs, recs.size(), NULL);
+}
+
+
+// read query in batches, check reads of a batch in parallel,
+// and print out the candidates in the input order
+void filterReads(const Cmdopts &cmdopts, BloomFilter &index) {
+
+  ifstream ifs(cmdopts.queryfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.queryfile << endl;
+    exit(1);
+  }
+
+  SeqReader reader(ifs);
+  vector<SeqRecord> recs(BATCHSIZE * cmdopts.nthreads); // reused for every batch
+  vector<char>      keep(recs.size());
+  uint64_t nreads = 0, nkept = 0;
+  for (;;) {
+    size_t n = 0;
+    while (n < recs.size() && reader.next(recs[n])) ++n;
+    if (n == 0) break;
+
+    runJobs(cmdopts, index, recs, n, &keep);
+    for (size_t i = 0; i < n; ++i) {
+      if (keep[i]) {
+	printRecord(recs[i]);
+	++nkept;
+      }
+    }
+    nreads += n;
+  }
+
+  cerr << nkept << " of " << nreads << " reads share k-mers with marker genes" << endl;
+}
+
+
+// split first n records among threads, index them (keep is NULL) or check them
+void runJobs(const Cmdopts &cmdopts, BloomFilter &index, vector<SeqRecord> &recs, size_t n, vector<char> *keep) {
+
+  Uint nthreads = cmdopts.nthreads;
+  vector<Job> jobs(nthreads);
+  vector<pthread_t> threads(nthreads);
+  for (Uint i = 0; i < nthreads; ++i) {
+    Job job = {&cmdopts, &index, &recs, keep, n * i / nthreads, n * (i+1) / nthreads};
+    jobs[i] = job;
+    if (i > 0 && pthread_create(&threads[i], NULL, keep ? filterJob : indexJob, &jobs[i]) != 0) {
+      cerr << "Could not create thread" << endl;
+      exit(1);
+    }
+  }
+  keep ? filterJob(&jobs[0]) : indexJob(&jobs[0]);
+  for (Uint i = 1; i < nthreads; ++i)
+    pthread_join(threads[i], NULL);
+}
+
+
+void *indexJob(void *arg) {
+
+  Job &job = *(Job *) arg;
+  vector<Kmer> kmers;
+  for (size_t i = job.begin; i < job.end; ++i) {
+    const string &seq = (*job.recs)[i].seq;
+    job.cmdopts->protein ? protKmers(seq, job.cmdopts->k, kmers) : dnaKmers(seq, job.cmdopts->k, kmers);
+    for (vector<Kmer>::const_iterator citer = kmers.begin(); citer != kmers.end(); ++citer)
+      job.index->insert(*citer);
+  }
+  return NULL;
+}
+
+
+void *filterJob(void *arg) {
+
+  Job &job = *(Job *) arg;
+  vector<Kmer> kmers;
+  for (size_t i = job.begin; i < job.end; ++i) {
+    const string &seq = (*job.recs)[i].seq;
+    job.cmdopts->protein ? sixFrameKmers(seq, job.cmdopts->k, kmers) : dnaKmers(seq, job.cmdopts->k, kmers);
+
+    Uint hits = 0;
+    for (vector<Kmer>::const_iterator citer = kmers.begin(); citer != kmers.end() && hits < job.cmdopts->minhits; ++citer)
+      if (job.index->contains(*citer)) ++hits;
+    (*job.keep)[i] = hits >= job.cmdopts->minhits;
+  }
+  return NULL;
+}
+
+
+// print a read in its input format
+void printRecord(const SeqRecord &rec) {
+
+  cout << rec.header << "\n" << rec.seq << "\n";
+  if (rec.header[0] == '@')
+    cout << "+\n" << rec.qual << "\n";
+}
+
+
+// parse command line options
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
+
+  cmdopts.k        = 0;
+  cmdopts.minhits  = 1;
+  cmdopts.bitsper  = 16;
+  cmdopts.nthreads = 1;
+  cmdopts.protein  = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "k:n:b:t:x")) != -1) {
+    switch (opt) {
+    case 'k': cmdopts.k        = atoi(optarg); break;
+    case 'n': cmdopts.minhits  = atoi(optarg); break;
+    case 'b': cmdopts.bitsper  = atoi(optarg); break;
+    case 't': cmdopts.nthreads = atoi(optarg); break;
+    case 'x': cmdopts.protein  = true; break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+
+  if (argc - optind != 2) {
+    helpmsg();
+    exit(1);
+  }
+  cmdopts.markerfile = argv[optind];
+  cmdopts.queryfile  = argv[optind+1];
+
+  if (cmdopts.k == 0) cmdopts.k = cmdopts.protein ? 11 : 21;
+  if (cmdopts.nthreads == 0) cmdopts.nthreads = 1;
+  if (cmdopts.minhits == 0) cmdopts.minhits = 1;
+  if (cmdopts.k > (cmdopts.protein ? 16u : 31u) || cmdopts.bitsper == 0) {
+    helpmsg();
+    exit(1);
+  }
+}
+
+
+// print out usage help message
+void helpmsg() {
+  cerr << endl;
+
+  cerr << "Usage:" << endl;
+  cerr << "        ./prefilter [options] <markers> <query>" << endl;
+  cerr << endl;
+  cerr << "        Print out reads that share k-mers with marker genes." << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "        <markers>    Marker genes in FASTA format (e.g., markers.dna)." << endl << endl;
+  cerr << "        <query>      Reads in FASTA or FASTQ format." << endl << endl;
+  cerr << "        -x           Markers are proteins (e.g., markers.protein), for blastx." << endl;
+  cerr << "                     Reads are translated in six frames, and amino acids are" << endl;
+  cerr << "                     compared in a reduced alphabet of 10 letters." << endl << endl;
+  cerr << "        -k <k>       k-mer length (default: 21; 11 amino acids with -x)." << endl << endl;
+  cerr << "        -n <hits>    Number of k-mers a read must share with markers (default: 1)." << endl << endl;
+  cerr << "        -b <bits>    Bloom filter bits for each marker k-mer (default: 16)." << endl << endl;
+  cerr << "        -t <threads> Number of threads (default: 1)." << endl << endl;
+
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
+}
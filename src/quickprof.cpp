@@ -0,0 +1,425 @@
+// Rough taxonomy profile of reads without alignment: k-mers of marker genes
+// are sketched (FracMinHash, 1 in <scale> k-mers is kept) and indexed by
+// the lineages of the genes they occur in; a read goes to the lineages
+// sharing most sketched k-mers with it, and reads that fit several lineages
+// are shared among them by EM over their abundances
+// Profiles are written as taxprof writes them
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+
+#include <sstream>
+using std::istringstream;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <unordered_map>
+using std::unordered_map;
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "kmer.h"
+#include "taxdb.h"
+
+typedef vector<string>             VS;
+typedef vector<Uint>               VI;
+typedef map<string, double>        S2D;
+typedef vector<S2D>                VS2D;
+typedef map<VI, double>            VI2D;
+typedef unordered_map<Kmer, Uint>  K2I;
+
+const Uint TLEV = 6;
+const Uint BATCHSIZE = 20000;   // reads per thread in a batch
+
+struct Cmdopts {
+  string markerfile,
+	 taxfile,
+	 queryfile,
+	 prefix,
+	 tnamesfile;
+  Uint   k,
+	 scale,
+	 minhits,
+	 maxiter,
+	 nthreads;
+  bool   protein;        // markers are proteins, reads are translated (blastx)
+};
+
+// sketched k-mers of markers, each with the set of lineages it occurs in
+struct Sketch {
+  Kmer   maxhash;        // k-mers hashing above it are not in the sketch
+  K2I    kmer2set;
+  vector<VI> sets;       // sorted lineage numbers
+  vector<VS> lineages;   // labels, lowest level first
+};
+
+// reads of a part of a batch; reads are counted by the set of lineages they fit
+struct Job {
+  const Cmdopts     *cmdopts;
+  const Sketch      *sketch;
+  vector<SeqRecord> *recs;
+  size_t            begin, end;
+  VI2D              classes;
+  double            nreads;
+};
+
+void helpmsg();
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
+void buildSketch(const Cmdopts &cmdopts, Sketch &sketch);
+double sketchReads(const Cmdopts &cmdopts, const Sketch &sketch, VI2D &classes);
+void *sketchJob(void *arg);
+void em(const VI2D &classes, Uint maxiter, vector<double> &counts);
+Uint readWeight(const string &header);
+
+
+int main(int argc, char *argv[]) {
+
+  // read in command line options
+  Cmdopts cmdopts;
+  getcmdopts(argc, argv, cmdopts);
+
+
+  Sketch sketch;
+  buildSketch(cmdopts, sketch);
+
+
+  // reads by the set of lineages they fit, in one pass
+  VI2D   classes;
+  double nreads = sketchReads(cmdopts, sketch, classes);
+
+
+  // expected reads of each lineage
+  vector<double> counts;
+  em(classes, cmdopts.maxiter, counts);
+
+
+  TaxNames tnames;
+  string   err;
+  if (cmdopts.tnamesfile != "" && tnames.read(cmdopts.tnamesfile, err) <= 0) {
+    cerr << err << endl;
+    exit(1);
+  }
+
+  // a lineage counts at each of its levels that are not NA
+  Uint nlevs = TLEV;
+  for (Uint lin = 0; lin < sketch.lineages.size(); ++lin)
+    nlevs = std::max<Uint>(nlevs, sketch.lineages[lin].size());
+  VS2D abund(nlevs, S2D());
+  double n = 0;
+  for (Uint lin = 0; lin < counts.size(); ++lin) {
+    if (counts[lin] <= 0) continue;
+    n += counts[lin];
+    const VS &labs = sketch.lineages[lin];
+    for (Uint lev = 0; lev < labs.size(); ++lev) {
+      if (labs[lev] == "NA") continue;
+      abund[lev][tnames.name(labs[lev])] += counts[lin];
+    }
+  }
+
+  if (!printtaxprof(abund, n, cmdopts.prefix, err)) {
+    cerr << err << endl;
+    exit(1);
+  }
+
+  cerr << (Uint) (n + 0.5) << " of " << (Uint) (nreads + 0.5) << " reads share k-mers with marker genes" << endl;
+  return 0;
+}
+
+
+// sketch k-mers of all marker genes that have a lineage
+void buildSketch(const Cmdopts &cmdopts, Sketch &sketch) {
+
+  Taxonomy tax;
+  VI       gene2lin;
+  string   err;
+  if (!readLineages(cmdopts.taxfile, tax, gene2lin, sketch.lineages, err)) {
+    cerr << err << endl;
+    exit(1);
+  }
+
+  ifstream ifs(cmdopts.markerfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.markerfile << endl;
+    exit(1);
+  }
+
+  sketch.maxhash = ~(Kmer) 0 / cmdopts.scale;
+
+  // lineages of each k-mer, then one copy of each distinct set
+  unordered_map<Kmer, VI> kmer2lins;
+  SeqReader reader(ifs);
+  SeqRecord rec;
+  vector<Kmer> kmers;
+  Uint ngenes = 0;
+  while (reader.next(rec)) {
+    int gene = tax.findGene(seqID(rec.header).c_str());
+    if (gene < 0) continue;
+    ++ngenes;
+
+    cmdopts.protein ? protKmers(rec.seq, cmdopts.k, kmers) : dnaKmers(rec.seq, cmdopts.k, kmers);
+    for (vector<Kmer>::const_iterator citer = kmers.begin(); citer != kmers.end(); ++citer) {
+      if (hashKmer(*citer) > sketch.maxhash) continue;
+      VI &lins = kmer2lins[*citer];
+      if (lins.empty() || lins.back() != gene2lin[gene]) lins.push_back(gene2lin[gene]);
+    }
+  }
+
+  map<VI, Uint> set2num;
+  for (unordered_map<Kmer, VI>::iterator iter = kmer2lins.begin(); iter != kmer2lins.end(); ++iter) {
+    VI &lins = iter->second;
+    std::sort(lins.begin(), lins.end());
+    lins.erase(std::unique(lins.begin(), lins.end()), lins.end());
+    std::pair<map<VI, Uint>::iterator, bool> ins = set2num.insert(map<VI, Uint>::value_type(lins, sketch.sets.size()));
+    if (ins.second) sketch.sets.push_back(lins);
+    sketch.kmer2set[iter->first] = ins.first->second;
+  }
+
+  cerr << sketch.kmer2set.size() << " sketched k-mers of " << ngenes << " genes, "
+       << sketch.lineages.size() << " lineages" << endl;
+}
+
+
+// read query in batches, and sketch reads of a batch in parallel
+// returns the number of reads
+double sketchReads(const Cmdopts &cmdopts, const Sketch &sketch, VI2D &classes) {
+
+  ifstream ifs(cmdopts.queryfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.queryfile << endl;
+    exit(1);
+  }
+
+  Uint nthreads = cmdopts.nthreads;
+  SeqReader reader(ifs);
+  vector<SeqRecord> recs(BATCHSIZE * nthreads); // reused for every batch
+  vector<Job>       jobs(nthreads);
+  vector<pthread_t> threads(nthreads);
+  for (Uint i = 0; i < nthreads; ++i) {
+    jobs[i].cmdopts = &cmdopts;
+    jobs[i].sketch  = &sketch;
+    jobs[i].recs    = &recs;
+    jobs[i].nreads  = 0;
+  }
+
+  for (;;) {
+    size_t n = 0;
+    while (n < recs.size() && reader.next(recs[n])) ++n;
+    if (n == 0) break;
+
+    for (Uint i = 0; i < nthreads; ++i) {
+      jobs[i].begin = n * i / nthreads;
+      jobs[i].end   = n * (i+1) / nthreads;
+      if (i > 0 && pthread_create(&threads[i], NULL, sketchJob, &jobs[i]) != 0) {
+	cerr << "Could not create thread" << endl;
+	exit(1);
+      }
+    }
+    sketchJob(&jobs[0]);
+    for (Uint i = 1; i < nthreads; ++i)
+      pthread_join(threads[i], NULL);
+  }
+
+  // merge counts of all threads
+  double nreads = 0;
+  for (Uint i = 0; i < nthreads; ++i) {
+    for (VI2D::const_iterator citer = jobs[i].classes.begin(); citer != jobs[i].classes.end(); ++citer)
+      classes[citer->first] += citer->second;
+    nreads += jobs[i].nreads;
+  }
+  return nreads;
+}
+
+
+void *sketchJob(void *arg) {
+
+  Job &job = *(Job *) arg;
+  const Cmdopts &cmdopts = *job.cmdopts;
+  const Sketch  &sketch  = *job.sketch;
+
+  vector<Kmer> kmers;
+  map<Uint, Uint> hits;
+  VI  best;
+  for (size_t i = job.begin; i < job.end; ++i) {
+    const SeqRecord &rec = (*job.recs)[i];
+    Uint weight = readWeight(rec.header);
+    job.nreads += weight;
+
+    cmdopts.protein ? sixFrameKmers(rec.seq, cmdopts.k, kmers) : dnaKmers(rec.seq, cmdopts.k, kmers);
+
+    // sketched k-mers the read shares with each lineage
+    hits.clear();
+    for (vector<Kmer>::const_iterator citer = kmers.begin(); citer != kmers.end(); ++citer) {
+      if (hashKmer(*citer) > sketch.maxhash) continue;
+      K2I::const_iterator siter = sketch.kmer2set.find(*citer);
+      if (siter == sketch.kmer2set.end()) continue;
+      const VI &lins = sketch.sets[siter->second];
+      for (VI::const_iterator liter = lins.begin(); liter != lins.end(); ++liter)
+	++hits[*liter];
+    }
+
+    // lineages sharing most of them
+    Uint most = 0;
+    best.clear();
+    for (map<Uint, Uint>::const_iterator citer = hits.begin(); citer != hits.end(); ++citer) {
+      if (citer->second > most) {
+	most = citer->second;
+	best.clear();
+      }
+      if (citer->second == most)
+	best.push_back(citer->first);
+    }
+    if (most >= cmdopts.minhits)
+      job.classes[best] += weight;
+  }
+  return NULL;
+}
+
+
+// expected reads of each lineage: a read that fits several lineages is
+// shared among them in proportion to their abundances, which are estimated
+// from these shares in turn
+void em(const VI2D &classes, Uint maxiter, vector<double> &counts) {
+
+  Uint nlins = 0;
+  double total = 0;
+  for (VI2D::const_iterator citer = classes.begin(); citer != classes.end(); ++citer) {
+    nlins = std::max(nlins, citer->first.back() + 1);
+    total += citer->second;
+  }
+
+  vector<double> abund(nlins, 1.0 / std::max<Uint>(nlins, 1));
+  for (Uint iter = 0; iter < maxiter || maxiter == 0; ++iter) {
+    counts.assign(nlins, 0);
+    for (VI2D::const_iterator citer = classes.begin(); citer != classes.end(); ++citer) {
+      double sum = 0;
+      for (VI::const_iterator liter = citer->first.begin(); liter != citer->first.end(); ++liter)
+	sum += abund[*liter];
+      if (sum <= 0) continue;
+      for (VI::const_iterator liter = citer->first.begin(); liter != citer->first.end(); ++liter)
+	counts[*liter] += citer->second * abund[*liter] / sum;
+    }
+
+    // stop once no abundance changes by more than a millionth
+    double change = 0;
+    for (Uint lin = 0; lin < nlins; ++lin) {
+      double a = counts[lin] / total;
+      change = std::max(change, fabs(a - abund[lin]));
+      abund[lin] = a;
+    }
+    if (change < 1e-6) break;
+  }
+}
+
+
+// number of reads a read stands for, from ";size=N" at the end of its ID
+// (dedup); 1 if it has none
+Uint readWeight(const string &header) {
+
+  string id = seqID(header);
+  size_t pos = id.rfind(";size=");
+  if (pos == string::npos || pos + 6 == id.size()
+      || id.find_first_not_of("0123456789", pos+6) != string::npos)
+    return 1;
+  Uint weight = atoi(id.c_str() + pos + 6);
+  return weight > 0 ? weight : 1;
+}
+
+
+// parse command line options
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
+
+  cmdopts.k        = 0;
+  cmdopts.scale    = 4;
+  cmdopts.minhits  = 2;
+  cmdopts.maxiter  = 100;
+  cmdopts.nthreads = 1;
+  cmdopts.protein  = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "k:s:n:i:t:x")) != -1) {
+    switch (opt) {
+    case 'k': cmdopts.k        = atoi(optarg); break;
+    case 's': cmdopts.scale    = atoi(optarg); break;
+    case 'n': cmdopts.minhits  = atoi(optarg); break;
+    case 'i': cmdopts.maxiter  = atoi(optarg); break;
+    case 't': cmdopts.nthreads = atoi(optarg); break;
+    case 'x': cmdopts.protein  = true; break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+
+  if (argc - optind != 4 && argc - optind != 5) {
+    helpmsg();
+    exit(1);
+  }
+  cmdopts.markerfile = argv[optind];
+  cmdopts.taxfile    = argv[optind+1];
+  cmdopts.queryfile  = argv[optind+2];
+  cmdopts.prefix     = argv[optind+3];
+  cmdopts.tnamesfile = argc - optind == 5 ? argv[optind+4] : "";
+
+  if (cmdopts.k == 0) cmdopts.k = cmdopts.protein ? 8 : 21;
+  if (cmdopts.nthreads == 0) cmdopts.nthreads = 1;
+  if (cmdopts.minhits == 0) cmdopts.minhits = 1;
+  if (cmdopts.k > (cmdopts.protein ? 16u : 31u) || cmdopts.scale == 0) {
+    helpmsg();
+    exit(1);
+  }
+}
+
+
+// print out usage help message
+void helpmsg() {
+  cerr << endl;
+
+  cerr << "Usage:" << endl;
+  cerr << "        ./quickprof [options] <markers> <taxonomy> <query> <prefix> [<taxonomy names>]" << endl;
+  cerr << endl;
+  cerr << "        Rough taxonomy profile of reads from k-mers shared with marker genes," << endl;
+  cerr << "        without BLAST; a read fitting several taxa is shared among them by EM." << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "        <markers>        Marker genes in FASTA format (e.g., markers.dna)." << endl << endl;
+  cerr << "        <taxonomy>       Taxonomy labels of marker genes (e.g., markers.taxonomy)," << endl;
+  cerr << "                         or a database compiled by taxdb." << endl << endl;
+  cerr << "        <query>          Reads in FASTA or FASTQ format." << endl << endl;
+  cerr << "        <prefix>         Output files prefix." << endl << endl;
+  cerr << "        <taxonomy names> File: 1st column, taxonomy ID; 2nd, name." << endl;
+  cerr << "                         If omitted, output will just use taxonomy IDs." << endl << endl;
+  cerr << "        -x               Markers are proteins (e.g., markers.protein). Reads are" << endl;
+  cerr << "                         translated in six frames, and amino acids are compared" << endl;
+  cerr << "                         in a reduced alphabet of 10 letters." << endl << endl;
+  cerr << "        -k <k>           k-mer length (default: 21; 8 amino acids with -x)." << endl << endl;
+  cerr << "        -s <scale>       Keep 1 in <scale> k-mers in the sketch (default: 4)." << endl << endl;
+  cerr << "        -n <hits>        Sketched k-mers a read must share with markers (default: 2)." << endl << endl;
+  cerr << "        -i <iterations>  Most EM iterations, 0 until it converges (default: 100)." << endl << endl;
+  cerr << "        -t <threads>     Number of threads (default: 1)." << endl << endl;
+
+  cerr << "Output files:" << endl;
+  cerr << "        prefix.<genus|family|order|class|phylum>.taxprof." << endl;
+  cerr << "                         Taxonomy profiles at each level, as of taxprof." << endl << endl;
+
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
+}
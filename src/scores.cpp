@@ -1,5 +1,13 @@
 // BLAST file: the simulated reads are mapped to reference genes
 // This program reports the scores in a histogram style
+//
+// With -g, the BLAST file aligns whole genes to reference genes instead, once
+// for all read lengths. Each hit is extended to where the two genes end and
+// aligned again base by base, and every read tiled along the gene (as
+// simuReads does) is scored on the columns it covers: the best local part of
+// them with a word hit, as BLAST would find aligning the read itself, with
+// the same scores and E-value cutoff. A read counts once for each strand of
+// a reference, with its best score over the hits.
 
 #include <iostream>
 using std::cout;
@@ -29,21 +37,49 @@ using std::greater;
 #include <ctime>
 #include <cmath>
 
+#include <unistd.h>
+
 #include <utility>
 using std::pair;
 
+#include "hits.h"
+#include "taxdb.h"
+
 
 typedef unsigned short int  Usint;
 typedef unsigned int        Uint;
 typedef vector<string>      VS;
-typedef map<string, VS>     S2VS;
+typedef vector<Uint>        VU;
 typedef vector<Usint>       VSI;
 typedef vector<VSI>         VVSI;
 typedef map<string, VVSI>   S2VVSI;
 typedef map<string, Uint>   S2I;
 typedef map<string, float>  S2F;
+typedef map<string, string> S2S;
 
 const unsigned int BITCUTOFF  = 1;
+const unsigned int WORDSIZE   = 15;     // of blastall -W, reads need such a run of matches
+const double       EVALUE     = 1e-3;   // of blastall -e
+const int          BAND       = 16;     // diagonals beyond those of the ends of a hit
+
+// a column of the alignment of a gene to a reference gene: op is '=' or 'X'
+// for aligned bases, 'I' for a gene base against a gap, 'D' for a reference
+// base against a gap, at qpos, i.e., between bases qpos-1 and qpos of the gene
+struct Column {
+  Uint qpos;
+  char op;
+};
+typedef vector<Column>      VC;
+typedef map<string, VSI>    S2VSI;
+
+// taxonomy of reference genes, and of the genes reads come from if they are
+// not the same (-q), with its label numbers translated to those of ref
+struct Taxa {
+  Taxonomy ref,
+	   query;
+  bool     qown;
+  VU       qlab2lab;
+};
 
 
 // stores command line options
@@ -51,18 +87,28 @@ struct Cmdopts{
   string taxfile,
          blastfile,
          blast,
-         refseq;
+         refseq,
+	 genefile,       // genes aligned in the BLAST file, with -g
+         qtaxfile;       // taxonomy of genes reads come from, if not taxfile
   Usint  readlen;
+  Uint   stepsize;       // of reads tiled along genes
 };
 
 void helpmsg();
 void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
-void readTaxFile(string taxfile, S2VS &seq2tax, S2I &tid2num);
-void train(string blastfile, S2VS &seq2tax, S2VVSI &seq2scores);
+void readTaxFile(string taxfile, Taxonomy &tax);
+void train(string blastfile, const Taxa &taxa, S2VVSI &seq2scores);
 void printScores(S2VVSI &seq2scores, Cmdopts &cmdopts, const S2I &ref2len);
 void printDistribution(S2VVSI &seq2scores, Cmdopts &cmdopts, const S2I &ref2len);
-Usint findlca(S2VS::iterator riter, S2VS::iterator qiter);
-void readRefseq(string refseqfile, S2I &ref2len, string blast);
+bool  queryLabels(const Taxa &taxa, const string &qid, VU &qlabs);
+Usint findlca(const Taxonomy &tax, Uint rgene, const VU &qlabs);
+Uint readWeight(const string &qid);
+void readRefseq(string refseqfile, S2I &ref2len, string blast, S2S *ref2seq = NULL);
+void trainGenes(const Cmdopts &cmdopts, const S2I &ref2len, const Taxa &taxa, S2VVSI &seq2scores);
+void alignSegments(const string &q, Uint qoff, const string &r, VC &cols);
+void scoreReads(const Cmdopts &cmdopts, const VC &cols, Uint genelen, double dblen, VSI &bits);
+void countReads(const string &qid, S2VSI *readbits, const Taxa &taxa, S2VVSI &seq2scores);
+string revcomp(const string &seq);
 
 
 int main(int argc, char *argv[]) {
@@ -75,13 +121,25 @@ int main(int argc, char *argv[]) {
   readRefseq(cmdopts.refseq, ref2len, cmdopts.blast);
 
 
-  S2VS seq2tax;            // taxonomic profile of each reference sequence
-  S2I  tid2num;            // number of genes under each lowest taxonomic cluster
-  readTaxFile(cmdopts.taxfile, seq2tax, tid2num);
+  Taxa taxa;               // taxonomic profile of each reference sequence
+  readTaxFile(cmdopts.taxfile, taxa.ref);
+
+  // reads of genes collapsed away (collapseMarkers) keep their own labels
+  taxa.qown = cmdopts.qtaxfile != "";
+  if (taxa.qown) {
+    readTaxFile(cmdopts.qtaxfile, taxa.query);
+    for (Uint lab = 0; lab < taxa.query.nlabels(); ++lab) {
+      int rlab = taxa.ref.findLabel(taxa.query.label(lab));
+      taxa.qlab2lab.push_back(rlab < 0 ? TAXDBNONE : rlab);
+    }
+  }
 
 
   S2VVSI seq2scores;       // bit scores under each taxonomic level for each sequence
-  train(cmdopts.blastfile, seq2tax, seq2scores);
+  if (cmdopts.genefile != "")
+    trainGenes(cmdopts, ref2len, taxa, seq2scores);
+  else
+    train(cmdopts.blastfile, taxa, seq2scores);
 
 
   //printScores(seq2scores, cmdopts, ref2len); // summarize scores and print them out
@@ -91,7 +149,8 @@ int main(int argc, char *argv[]) {
 }
 
 
-void readRefseq(string refseqfile, S2I &ref2len, string blast) {
+// lengths of reference sequences, and their sequences if ref2seq is given
+void readRefseq(string refseqfile, S2I &ref2len, string blast, S2S *ref2seq) {
 
   ifstream ifs(refseqfile.c_str());
   if (!ifs) {
@@ -101,7 +160,7 @@ void readRefseq(string refseqfile, S2I &ref2len, string blast) {
 
 
   // simulate reads from each fasta sequence
-  string eachline, seqid("");
+  string eachline, seqid(""), seq;
   Uint len = 0;
   istringstream iss;
   while (getline(ifs, eachline)) {
@@ -112,6 +171,10 @@ void readRefseq(string refseqfile, S2I &ref2len, string blast) {
 	len *= 3;
       ref2len.insert(S2I::value_type(seqid, len));
 
+      if (ref2seq != NULL && seqid != "")
+	(*ref2seq)[seqid].swap(seq);
+      seq.clear();
+
       iss.clear();
       iss.str(eachline);
       iss >> seqid;
@@ -119,47 +182,28 @@ void readRefseq(string refseqfile, S2I &ref2len, string blast) {
       seqid.erase(0, 1); // remove '>'
       len = 0;
     }
-    else
+    else {
       len += eachline.size();   // store sequences
+      if (ref2seq != NULL)
+	seq += eachline;
+    }
   }
 
   if (blast == "blastx")
     len *= 3;
   ref2len.insert(S2I::value_type(seqid, len));
+  if (ref2seq != NULL && seqid != "")
+    (*ref2seq)[seqid].swap(seq);
 }
 
 
-// load in taxonomy file
-void readTaxFile(string taxfile, S2VS &seq2tax, S2I &tid2num) {
-
-  ifstream ifs(taxfile.c_str());
-  if (!ifs)
-    cerr << "Could not open file " << taxfile << endl;
+// load in taxonomy file, or a database compiled from it
+void readTaxFile(string taxfile, Taxonomy &tax) {
 
-  string eachline, eachword, seqid;
-  VS tlabs;
-  istringstream iss;
-  while (getline(ifs, eachline)) {
-
-    tlabs.clear();
-    iss.clear();
-    iss.str(eachline);
-    iss >> seqid >> eachword;
-    
-    // consider the lowest taxonomic level as clusters
-    if (eachword != "NA") {
-      if (tid2num.find(eachword) == tid2num.end())
-	tid2num.insert(S2I::value_type(eachword, 1));
-      
-      else // store the abundance of each cluster
-	++(tid2num.find(eachword)->second);
-    }
-
-    // store taxonomic labels of each gene
-    tlabs.push_back(eachword);
-    while(iss >> eachword)
-      tlabs.push_back(eachword);
-    seq2tax.insert( pair<string, VS> (seqid, tlabs) );
+  string err;
+  if (tax.read(taxfile, err) <= 0) {
+    cerr << err << endl;
+    exit(1);
   }
 }
 
@@ -167,7 +211,21 @@ void readTaxFile(string taxfile, S2VS &seq2tax, S2I &tid2num) {
 // parse command line options
 void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
 
-  if (argc != 6) {
+  cmdopts.stepsize = 30;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "g:s:q:")) != -1) {
+    switch (opt) {
+    case 'q': cmdopts.qtaxfile = optarg; break;
+    case 'g': cmdopts.genefile = optarg; break;
+    case 's': cmdopts.stepsize = atoi(optarg); break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (argc != 6 || cmdopts.stepsize == 0) {
     helpmsg();
     exit(1);
   }
@@ -178,6 +236,12 @@ void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
   cmdopts.blastfile = argv[3];
   cmdopts.readlen   = atoi(argv[4]);
   cmdopts.blast     = argv[5];
+
+  // base by base alignments are scored as of blastn
+  if (cmdopts.genefile != "" && cmdopts.blast != "blastn" && cmdopts.blast != "BLASTN") {
+    cerr << "Genes (-g) can only be aligned with blastn" << endl;
+    exit(1);
+  }
 }
 
 
@@ -258,68 +322,378 @@ void printDistribution(S2VVSI &seq2scores, Cmdopts &cmdopts, const S2I &ref2len)
 
 // process blast bit scores, compare the tax labels between query and reference
 // store them in corresponding tax level
-void train(string blastfile, S2VS &seq2tax, S2VVSI &seq2scores) {
+void train(string blastfile, const Taxa &taxa, S2VVSI &seq2scores) {
   
-  ifstream blastfile_ifs(blastfile.c_str());
-  if (!blastfile_ifs)
+  // SAM, BAM and PAF hits are read as BLAST -m8 lines
+  HitFile hitfile;
+  VS      nomates;
+  if (!hitfile.open(blastfile, hitFormat(blastfile), nomates)) {
     cerr << "Could not open file: " << blastfile << endl;
+    exit(1);
+  }
 
   string eachline;
-  while (getline(blastfile_ifs, eachline)) {
+  off_t  linepos;
+  VU     qlabs;
+  while (hitfile.next(eachline, linepos)) {
 
     size_t pos1 = eachline.find("\t");
     string qid  = eachline.substr(0, pos1);
+    Uint weight = readWeight(qid); // reads of adaptive simulation stand for several
     qid.resize(qid.rfind('_'));    // trim the end of the simulated ID
     
     size_t pos2 = eachline.find("\t", pos1+1);
     string rid  = eachline.substr(pos1+1, pos2-pos1-1);
     
-    size_t pos3 = eachline.rfind(" ") != string::npos ? eachline.rfind(" ") : eachline.rfind("\t"); // sometimes an extract space before bit score
-    string bit_str = eachline.substr(pos3+1, eachline.size()-pos3-1);
-    Usint bit   = atoi(bit_str.c_str());
+    Usint bit   = m8Bits(eachline);
 
     if (bit < BITCUTOFF) continue; // ignore bad blast hit
 
     // taxonomic labels should be available for both sequences
-    S2VS::iterator qiter = seq2tax.find(qid);
-    S2VS::iterator riter = seq2tax.find(rid);
-    if (qiter == seq2tax.end() || riter == seq2tax.end()) continue;
+    int rgene = taxa.ref.findGene(rid.c_str());
+    if (rgene < 0 || taxa.ref.nlabs(rgene) == 0 || !queryLabels(taxa, qid, qlabs)) continue;
 
     // suppose sequence A has 5 tax labels, then we need 6 vectors to store bit scores
     // for each level plus an "other" level
     if (seq2scores.find(rid) == seq2scores.end())
-      seq2scores.insert(S2VVSI::value_type(rid, VVSI(riter->second.size()+1, VSI())));
+      seq2scores.insert(S2VVSI::value_type(rid, VVSI(taxa.ref.nlabs(rgene)+1, VSI())));
 
-    Usint lca = findlca(riter, qiter);
+    Usint lca = findlca(taxa.ref, rgene, qlabs);
     
     // their tax labels match at level lca of reference sequence
     S2VVSI::iterator scoreiter = seq2scores.find(rid);
-    scoreiter->second[lca].push_back(bit);
+    scoreiter->second[lca].insert(scoreiter->second[lca].end(), weight, bit);
 
   }
-  
+  if (hitfile.failed) {
+    cerr << "Could not read file " << blastfile << endl;
+    exit(1);
+  }
 }
 
 
-// Find lowest common ancester between query and reference w.r.t reference
-// For example, reference: A B C D, query: E C F G,
-// then this function returns 2, because reference[2] = C = query[1];
-Usint findlca(S2VS::iterator riter, S2VS::iterator qiter) {
+// train on alignments of whole genes: reads tiled along each gene are scored
+// on the columns of its hits they cover, and counted as if BLAST had aligned
+// each read to the reference sequence
+void trainGenes(const Cmdopts &cmdopts, const S2I &ref2len, const Taxa &taxa, S2VVSI &seq2scores) {
 
-  Usint i = 0;
-  bool tag = false;
-  for (VS::const_iterator rtiter = riter->second.begin(); rtiter != riter->second.end(); ++rtiter, ++i) {
+  S2I gene2len, reflen;
+  S2S gene2seq, ref2seq;
+  readRefseq(cmdopts.genefile, gene2len, cmdopts.blast, &gene2seq);
+  readRefseq(cmdopts.refseq, reflen, cmdopts.blast, &ref2seq);
+
+  // search space of E-values: reads against the whole reference database
+  double dblen = 0;
+  for (S2I::const_iterator citer = ref2len.begin(); citer != ref2len.end(); ++citer)
+    dblen += citer->second;
+
+  ifstream ifs(cmdopts.blastfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.blastfile << endl;
+    exit(1);
+  }
+
+  // best score of each read of a gene to each reference, by strand;
+  // hits of a gene come together
+  S2VSI readbits[2];
+  string eachline, qid, rid, lastqid;
+  istringstream iss;
+  VC cols;
+  while (getline(ifs, eachline)) {
+
+    float ident;
+    Uint  alen, mism, gaps, qstart, qend, sstart, send;
+    iss.clear();
+    iss.str(eachline);
+    if (!(iss >> qid >> rid >> ident >> alen >> mism >> gaps >> qstart >> qend >> sstart >> send))
+      continue;
+
+    if (qid != lastqid) {
+      countReads(lastqid, readbits, taxa, seq2scores);
+      lastqid = qid;
+    }
+
+    S2S::const_iterator gsiter = gene2seq.find(qid);
+    S2S::const_iterator rsiter = ref2seq.find(rid);
+    if (gsiter == gene2seq.end() || rsiter == ref2seq.end()) continue;
+    const string &gene = gsiter->second, &ref = rsiter->second;
+    Uint glen = gene.size(), rlen = ref.size();
+    if (qstart < 1 || qstart > qend || qend > glen
+	|| std::max(sstart, send) > rlen || std::min(sstart, send) < 1)
+      continue;
+
+    // hits to the minus strand are aligned to the reverse complement; both
+    // ends are extended along their diagonals as far as the genes go, and
+    // aligned apart from the hit, so that the hit is aligned as BLAST did
+    bool plus = sstart <= send;
+    string rstr = plus ? ref : revcomp(ref);
+    Uint qb = qstart - 1, qe = qend;   // [qb, qe) and [rb, re)
+    Uint rb = plus ? sstart - 1 : rlen - sstart, re = plus ? send : rlen - send + 1;
+    Uint left = std::min(qb, rb), right = std::min(glen - qe, rlen - re);
+    cols.clear();
+    alignSegments(gene.substr(qb-left, left), qb-left, rstr.substr(rb-left, left), cols);
+    alignSegments(gene.substr(qb, qe-qb), qb, rstr.substr(rb, re-rb), cols);
+    alignSegments(gene.substr(qe, right), qe, rstr.substr(re, right), cols);
+    scoreReads(cmdopts, cols, glen, dblen, readbits[plus ? 0 : 1][rid]);
+  }
+  countReads(lastqid, readbits, taxa, seq2scores);
+}
+
+
+// add the scores of reads of a gene to each reference, by the lowest common
+// ancestor of the two, and clear them for the next gene
+void countReads(const string &qid, S2VSI *readbits, const Taxa &taxa, S2VVSI &seq2scores) {
 
-    if (*rtiter == "NA") continue;
+  VU qlabs;
+  bool qfound = queryLabels(taxa, qid, qlabs);
+  for (Uint strand = 0; strand < 2; ++strand) {
+    for (S2VSI::const_iterator citer = readbits[strand].begin(); citer != readbits[strand].end(); ++citer) {
 
-    for (VS::const_iterator qtiter = qiter->second.begin(); qtiter != qiter->second.end(); ++qtiter) {
-      if (*rtiter == *qtiter) {
-	tag = true;
-	break;
+      // taxonomic labels should be available for both sequences
+      const string &rid = citer->first;
+      int rgene = taxa.ref.findGene(rid.c_str());
+      if (!qfound || rgene < 0 || taxa.ref.nlabs(rgene) == 0) continue;
+
+      if (seq2scores.find(rid) == seq2scores.end())
+	seq2scores.insert(S2VVSI::value_type(rid, VVSI(taxa.ref.nlabs(rgene)+1, VSI())));
+
+      Usint lca = findlca(taxa.ref, rgene, qlabs);
+      VSI &scores = seq2scores.find(rid)->second[lca];
+      for (VSI::const_iterator biter = citer->second.begin(); biter != citer->second.end(); ++biter)
+	if (*biter > 0)
+	  scores.push_back(*biter);
+    }
+    readbits[strand].clear();
+  }
+}
+
+
+// global alignment of a gene segment starting at qoff to a reference segment,
+// with blastn scores and affine gaps, within a band of diagonals around those
+// of the two ends; its columns are added to cols in the order of the gene
+void alignSegments(const string &q, Uint qoff, const string &r, VC &cols) {
+
+  const int NEG = -1000000000;
+  int n = q.size(), m = r.size();
+  int dlo = std::min(0, m-n) - BAND, dhi = std::max(0, m-n) + BAND;
+  int width = dhi - dlo + 1;
+
+  // scores of the last and this row; H ends in any column, E in a 'D' gap,
+  // F in an 'I' gap; trace keeps where each of them came from
+  vector<int> H0(width, NEG), E0(width, NEG), F0(width, NEG);
+  vector<int> H1(width, NEG), E1(width, NEG), F1(width, NEG);
+  vector<unsigned char> trace((size_t) (n+1) * width, 0);
+
+  for (int i = 0; i <= n; ++i) {
+    for (int k = 0; k < width; ++k) {
+      int j = i + dlo + k;
+      H1[k] = E1[k] = F1[k] = NEG;
+      if (j < 0 || j > m) continue;
+
+      unsigned char tb = 0;
+      if (i == 0 && j == 0) {
+	H1[k] = 0;
+	trace[(size_t) i*width + k] = tb;
+	continue;
+      }
+
+      // 'D': reference base j-1 against a gap, from the left
+      if (j > 0 && k > 0) {
+	int open = H1[k-1] - NGAPOPEN - NGAPEXT, ext = E1[k-1] - NGAPEXT;
+	E1[k] = std::max(open, ext);
+	if (ext > open) tb |= 4;
+      }
+      // 'I': gene base i-1 against a gap, from above
+      if (i > 0 && k+1 < width) {
+	int open = H0[k+1] - NGAPOPEN - NGAPEXT, ext = F0[k+1] - NGAPEXT;
+	F1[k] = std::max(open, ext);
+	if (ext > open) tb |= 8;
+      }
+
+      int best = E1[k], from = 1;
+      if (F1[k] > best) {
+	best = F1[k];
+	from = 2;
+      }
+      if (i > 0 && j > 0 && H0[k] > NEG) {
+	int diag = H0[k] + (q[i-1] == r[j-1] ? NREWARD : -NPENALTY);
+	if (diag >= best) {
+	  best = diag;
+	  from = 0;
+	}
+      }
+      H1[k] = best;
+      trace[(size_t) i*width + k] = tb | from;
+    }
+    H0.swap(H1);
+    E0.swap(E1);
+    F0.swap(F1);
+  }
+
+  // trace back from the end, in the state each step came from
+  size_t ncols = cols.size();
+  int i = n, j = m, state = 0;   // 0, H; 1, E; 2, F
+  while (i > 0 || j > 0) {
+    unsigned char tb = trace[(size_t) i*width + (j - i - dlo)];
+    if (state == 0)
+      state = tb & 3;
+    Column col;
+    if (state == 0) {
+      col.qpos = qoff + i - 1;
+      col.op   = q[i-1] == r[j-1] ? '=' : 'X';
+      --i;
+      --j;
+    }
+    else if (state == 1) {
+      col.qpos = qoff + i;
+      col.op   = 'D';
+      state    = tb & 4 ? 1 : 0;
+      --j;
+    }
+    else {
+      col.qpos = qoff + i - 1;
+      col.op   = 'I';
+      state    = tb & 8 ? 2 : 0;
+      --i;
+    }
+    cols.push_back(col);
+  }
+  std::reverse(cols.begin() + ncols, cols.end());
+}
+
+
+// bit scores of reads tiled along a gene on the columns of one of its hits;
+// a read gets the best scoring run of its columns that has a word hit, if
+// its E-value is within the cutoff, and bits[i] of the i-th read is kept if
+// higher (0 if none)
+void scoreReads(const Cmdopts &cmdopts, const VC &cols, Uint genelen, double dblen, VSI &bits) {
+
+  Uint len = cmdopts.readlen, step = cmdopts.stepsize;
+  if (cols.empty() || genelen < len) return;
+  bits.resize((genelen - len) / step + 1, 0);
+
+  // reads overlapping the hit
+  Uint first = cols.front().qpos, last = cols.back().qpos;
+  Uint read  = first + 1 > len ? (first + 1 - len + step - 1) / step : 0;
+  for (; read * step + len <= genelen && read * step <= last; ++read) {
+    Uint beg = read * step, end = beg + len;
+
+    // columns of bases in [beg, end), and gaps between them
+    VC::const_iterator citer = cols.begin();
+    while (citer != cols.end() && (citer->qpos < beg || (citer->qpos == beg && citer->op == 'D')))
+      ++citer;
+
+    AlnStats cur = {0, 0, 0, 0, 0}, best = cur;
+    int  score = 0, bestscore = 0;
+    Uint run = 0, word = 0;
+    char prev = 0;
+    for (; citer != cols.end() && citer->qpos < end; ++citer) {
+      char op = citer->op;
+      ++cur.len;
+      if (op == '=') {
+	score += NREWARD;
+	++cur.matches;
+	word = std::max(word, ++run);
+      }
+      else {
+	run = 0;
+	if (op == 'X') {
+	  score -= NPENALTY;
+	  ++cur.mismatches;
+	}
+	else {
+	  score -= NGAPEXT;
+	  ++cur.gaps;
+	  if (op != prev) {
+	    score -= NGAPOPEN;
+	    ++cur.gapopens;
+	  }
+	}
+      }
+      prev = op;
+
+      // a run that does not score positive is no start for a better one
+      if (score <= 0) {
+	score = 0;
+	cur.len = cur.matches = cur.mismatches = cur.gapopens = cur.gaps = 0;
+	run = word = 0;
+	prev = 0;
+      }
+      else if (word >= WORDSIZE && score > bestscore) {
+	bestscore = score;
+	best = cur;
       }
     }
+    if (bestscore == 0) continue;
 
-    if (tag) break; 
+    // the E-value is of the bit score with its decimals, as blastall has it
+    Usint bit = bitScore(best);
+    if (bit < BITCUTOFF || len * dblen * pow(2.0, -exactBits(best)) > EVALUE)
+      continue;
+    bits[read] = std::max(bits[read], bit);
+  }
+}
+
+
+string revcomp(const string &seq) {
+
+  string rc(seq.rbegin(), seq.rend());
+  for (string::iterator iter = rc.begin(); iter != rc.end(); ++iter) {
+    switch (*iter) {
+    case 'A': *iter = 'T'; break;
+    case 'C': *iter = 'G'; break;
+    case 'G': *iter = 'C'; break;
+    case 'T': *iter = 'A'; break;
+    case 'a': *iter = 't'; break;
+    case 'c': *iter = 'g'; break;
+    case 'g': *iter = 'c'; break;
+    case 't': *iter = 'a'; break;
+    }
+  }
+  return rc;
+}
+
+
+// number of reads a simulated read stands for, from ";size=W" at the end
+// of its ID (simuReads -a); 1 if it has none
+Uint readWeight(const string &qid) {
+
+  size_t pos = qid.rfind(";size=");
+  if (pos == string::npos || pos + 6 == qid.size()
+      || qid.find_first_not_of("0123456789", pos+6) != string::npos)
+    return 1;
+  Uint weight = atoi(qid.c_str() + pos + 6);
+  return weight > 0 ? weight : 1;
+}
+
+
+// labels of the gene a read comes from, numbered as those of reference genes;
+// false if it has none
+bool queryLabels(const Taxa &taxa, const string &qid, VU &qlabs) {
+
+  const Taxonomy &qtax = taxa.qown ? taxa.query : taxa.ref;
+  int qgene = qtax.findGene(qid.c_str());
+  if (qgene < 0 || qtax.nlabs(qgene) == 0) return false;
+
+  qlabs.clear();
+  for (Uint lev = 0; lev < qtax.nlabs(qgene); ++lev) {
+    Uint lab = qtax.labelAt(qgene, lev);
+    qlabs.push_back(taxa.qown && lab != TAXDBNONE ? taxa.qlab2lab[lab] : lab);
+  }
+  return true;
+}
+
+
+// Find lowest common ancester between query and reference w.r.t reference
+// For example, reference: A B C D, query: E C F G,
+// then this function returns 2, because reference[2] = C = query[1];
+Usint findlca(const Taxonomy &tax, Uint rgene, const VU &qlabs) {
+
+  Usint i = 0;
+  for (; i < tax.nlabs(rgene); ++i) {
+    Uint lab = tax.labelAt(rgene, i);
+    if (lab != TAXDBNONE && std::find(qlabs.begin(), qlabs.end(), lab) != qlabs.end())
+      break;
   }
 
   return i;
@@ -331,23 +705,38 @@ void helpmsg() {
   cerr << endl;
 
   cerr << "Usage:" << endl;
-  cerr << "        ./metaphylerTrain <taxonomy file> <ref seq> <BLAST file> <length> <BLAST program>" << endl;
+  cerr << "        ./metaphylerTrain [-g <genes> [-s <step>]] [-q <taxonomy file>] <taxonomy file> <ref seq> <BLAST file> <length> <BLAST program>" << endl;
   cerr << endl;
 
   cerr << "Options:" << endl;
 
-  cerr << "        <taxonomy file> Taxonomy labels of reference sequences in the BLAST file." << endl << endl;
+  cerr << "        <taxonomy file> Taxonomy labels of reference sequences in the BLAST file," << endl;
+  cerr << "                        or a database compiled from them by taxdb." << endl << endl;
 
   cerr << "        <ref seq>       Reference sequence FASTA file." << endl << endl;
 
   cerr << "        <BLAST file>    BLAST alignment between simulated reads and reference sequences." << endl;
   cerr << "                        All simulated reads come from reference sequences, and are named as follows:" << endl;
   cerr << "                        If n reads come from A, then their IDs are A_0, A_1,..., A_n-1." << endl;
+  cerr << "                        A read named A_i;size=W (simuReads -a) is counted W times." << endl;
+  cerr << "                        SAM, BAM or PAF files (.sam, .bam, .paf) of a read mapper can be used too;" << endl;
+  cerr << "                        their bit scores are computed with blastn scores." << endl << endl;
 
   cerr << "        <length>        Length of simulated reads." << endl << endl;
 
   cerr << "        <BLAST program> BLASTN, BLASTP, BLASTX or TBLASTX." << endl << endl;
 
+  cerr << "        -g <genes>      The BLAST file aligns these genes (FASTA) to reference sequences," << endl;
+  cerr << "                        blastn -m8, instead of simulated reads. Reads of <length> every" << endl;
+  cerr << "                        <step> bases of each gene are scored on the alignments, so one" << endl;
+  cerr << "                        BLAST run of whole genes serves all read lengths." << endl << endl;
+
+  cerr << "        -s <step>       Step size of reads along genes, as of simuReads (default: 30)." << endl << endl;
+
+  cerr << "        -q <taxonomy file> Taxonomy labels of the genes reads come from, if not all of" << endl;
+  cerr << "                        them are reference sequences, e.g., when references are" << endl;
+  cerr << "                        collapsed (collapseMarkers) and reads are of all genes." << endl << endl;
+
   
   cerr << "Contact:" << endl;
   cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
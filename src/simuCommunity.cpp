@@ -0,0 +1,288 @@
+// Simulate a metagenome from marker genes with a given taxonomic profile:
+// reads are drawn from the genes of each taxon in proportion to its
+// abundance, and to gene lengths within a taxon, with substitution errors.
+// The true profile of the reads is written as taxprof writes profiles, so
+// that profiles of a pipeline run can be scored against it (scorecard.pl).
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+
+#include <sstream>
+using std::istringstream;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "kmer.h"
+#include "taxdb.h"
+
+typedef vector<string>             VS;
+typedef vector<Uint>               VI;
+typedef vector<double>             VD;
+typedef map<string, Uint>          S2I;
+typedef vector<S2I>                VS2I;
+
+const Uint TLEV = 6;
+
+struct Cmdopts {
+  string markerfile,
+	 taxfile,
+	 proffile,
+	 prefix,
+	 tnamesfile;
+  Uint   nreads,
+	 length,
+	 seed;
+  double errate;         // substitutions per base
+};
+
+// genes of a taxon of the profile, and where each is in the cumulative length
+struct Taxon {
+  string name;
+  double abund;
+  VI     genes;
+  VD     cumlen;
+};
+
+void helpmsg();
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
+void readProfile(string proffile, vector<Taxon> &taxa);
+Uint pick(const VD &cum, double x);
+
+
+int main(int argc, char *argv[]) {
+
+  // read in command line options
+  Cmdopts cmdopts;
+  getcmdopts(argc, argv, cmdopts);
+  srand48(cmdopts.seed);
+
+
+  Taxonomy   tax;
+  VI         gene2lin;
+  vector<VS> lineages;
+  string     err;
+  if (!readLineages(cmdopts.taxfile, tax, gene2lin, lineages, err)) {
+    cerr << err << endl;
+    exit(1);
+  }
+
+  vector<Taxon> taxa;
+  readProfile(cmdopts.proffile, taxa);
+
+
+  // marker genes long enough for a read, and their lineages
+  ifstream ifs(cmdopts.markerfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << cmdopts.markerfile << endl;
+    exit(1);
+  }
+  VS ids, seqs;
+  VI lins;
+  SeqReader reader(ifs);
+  SeqRecord rec;
+  while (reader.next(rec)) {
+    int gene = tax.findGene(seqID(rec.header).c_str());
+    if (gene < 0 || rec.seq.size() < cmdopts.length) continue;
+    ids.push_back(tax.geneID(gene));
+    seqs.push_back(rec.seq);
+    lins.push_back(gene2lin[gene]);
+  }
+
+
+  // genes under each taxon of the profile, at any level
+  VD cumabund;
+  double total = 0;
+  for (vector<Taxon>::iterator titer = taxa.begin(); titer != taxa.end(); ++titer) {
+    double cum = 0;
+    for (Uint gene = 0; gene < ids.size(); ++gene) {
+      const VS &labs = lineages[lins[gene]];
+      if (std::find(labs.begin(), labs.end(), titer->name) == labs.end()) continue;
+      titer->genes.push_back(gene);
+      cum += seqs[gene].size() - cmdopts.length + 1;
+      titer->cumlen.push_back(cum);
+    }
+    if (titer->genes.empty()) {
+      cerr << "No marker genes of " << titer->name << endl;
+      exit(1);
+    }
+    total += titer->abund;
+    cumabund.push_back(total);
+  }
+
+
+  // draw reads, and count them at each level of their lineages
+  Uint nlevs = TLEV;
+  for (Uint lin = 0; lin < lineages.size(); ++lin)
+    nlevs = std::max<Uint>(nlevs, lineages[lin].size());
+  VS2I truth(nlevs, S2I());
+  string read;
+  for (Uint i = 0; i < cmdopts.nreads; ++i) {
+
+    const Taxon &taxon = taxa[pick(cumabund, drand48() * total)];
+    Uint k    = pick(taxon.cumlen, drand48() * taxon.cumlen.back());
+    Uint gene = taxon.genes[k];
+    Uint pos  = (Uint) (drand48() * (seqs[gene].size() - cmdopts.length + 1));
+    bool rev  = drand48() < 0.5;
+
+    read = seqs[gene].substr(pos, cmdopts.length);
+    if (rev) {
+      string rc;
+      revcomp(read, rc);
+      read.swap(rc);
+    }
+    for (string::iterator iter = read.begin(); iter != read.end(); ++iter) {
+      if (drand48() >= cmdopts.errate) continue;
+      Uint c = baseCode(*iter);
+      *iter = "ACGT"[c > 3 ? lrand48() % 4 : (c + 1 + lrand48() % 3) % 4];
+    }
+
+    cout << ">read" << i+1 << " " << ids[gene] << " " << pos+1 << " " << (rev ? '-' : '+') << "\n" << read << "\n";
+
+    const VS &labs = lineages[lins[gene]];
+    for (Uint lev = 0; lev < labs.size(); ++lev)
+      if (labs[lev] != "NA")
+	++truth[lev][labs[lev]];
+  }
+
+
+  // true profile, by name if names are given
+  TaxNames tnames;
+  if (cmdopts.tnamesfile != "" && tnames.read(cmdopts.tnamesfile, err) <= 0) {
+    cerr << err << endl;
+    exit(1);
+  }
+  VS2I named(nlevs, S2I());
+  for (Uint lev = 0; lev < nlevs; ++lev)
+    for (S2I::const_iterator citer = truth[lev].begin(); citer != truth[lev].end(); ++citer)
+      named[lev][tnames.name(citer->first)] += citer->second;
+  if (!printtaxprof(named, cmdopts.nreads, cmdopts.prefix, err)) {
+    cerr << err << endl;
+    exit(1);
+  }
+
+  return 0;
+}
+
+
+// taxonomy label (at any level) and its relative abundance on each line
+void readProfile(string proffile, vector<Taxon> &taxa) {
+
+  ifstream ifs(proffile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << proffile << endl;
+    exit(1);
+  }
+
+  string eachline;
+  istringstream iss;
+  while (getline(ifs, eachline)) {
+    if (eachline.empty() || eachline[0] == '#') continue;
+    Taxon taxon;
+    iss.clear();
+    iss.str(eachline);
+    if (!(iss >> taxon.name >> taxon.abund) || taxon.abund < 0) {
+      cerr << "Bad line in profile " << proffile << ": " << eachline << endl;
+      exit(1);
+    }
+    if (taxon.abund > 0)
+      taxa.push_back(taxon);
+  }
+
+  if (taxa.empty()) {
+    cerr << "No taxa in profile " << proffile << endl;
+    exit(1);
+  }
+}
+
+
+// first of the cumulative weights above x
+Uint pick(const VD &cum, double x) {
+  Uint k = std::upper_bound(cum.begin(), cum.end(), x) - cum.begin();
+  return k < cum.size() ? k : cum.size() - 1;
+}
+
+
+// parse command line options
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
+
+  cmdopts.nreads = 100000;
+  cmdopts.length = 100;
+  cmdopts.errate = 0;
+  cmdopts.seed   = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:l:e:s:")) != -1) {
+    switch (opt) {
+    case 'n': cmdopts.nreads = atoi(optarg); break;
+    case 'l': cmdopts.length = atoi(optarg); break;
+    case 'e': cmdopts.errate = atof(optarg); break;
+    case 's': cmdopts.seed   = atoi(optarg); break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+
+  if ((argc - optind != 4 && argc - optind != 5) || cmdopts.length == 0
+      || cmdopts.errate < 0 || cmdopts.errate > 1) {
+    helpmsg();
+    exit(1);
+  }
+  cmdopts.markerfile = argv[optind];
+  cmdopts.taxfile    = argv[optind+1];
+  cmdopts.proffile   = argv[optind+2];
+  cmdopts.prefix     = argv[optind+3];
+  cmdopts.tnamesfile = argc - optind == 5 ? argv[optind+4] : "";
+}
+
+
+// print out usage help message
+void helpmsg() {
+  cerr << endl;
+
+  cerr << "Usage:" << endl;
+  cerr << "        ./simuCommunity [options] <markers> <taxonomy> <profile> <prefix> [<taxonomy names>]" << endl;
+  cerr << endl;
+  cerr << "        Print out reads drawn from marker genes of the taxa in a profile," << endl;
+  cerr << "        and write their true profile." << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "        <markers>        Marker genes in FASTA format (e.g., markers.dna)." << endl << endl;
+  cerr << "        <taxonomy>       Taxonomy labels of marker genes (e.g., markers.taxonomy)," << endl;
+  cerr << "                         or a database compiled by taxdb." << endl << endl;
+  cerr << "        <profile>        Taxonomy label (of any level) and relative abundance on each" << endl;
+  cerr << "                         line. Reads of a taxon come from all of its genes." << endl << endl;
+  cerr << "        <prefix>         Prefix of the true profile files." << endl << endl;
+  cerr << "        <taxonomy names> File: 1st column, taxonomy ID; 2nd, name." << endl;
+  cerr << "                         If omitted, true profiles will just use taxonomy IDs." << endl << endl;
+  cerr << "        -n <reads>       Number of reads (default: 100000)." << endl << endl;
+  cerr << "        -l <length>      Read length (default: 100)." << endl << endl;
+  cerr << "        -e <rate>        Substitution errors per base (default: 0)." << endl << endl;
+  cerr << "        -s <seed>        Random seed (default: 1)." << endl << endl;
+
+  cerr << "Output files:" << endl;
+  cerr << "        prefix.<genus|family|order|class|phylum>.taxprof." << endl;
+  cerr << "                         True profiles at each level, as of taxprof." << endl << endl;
+
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
+}
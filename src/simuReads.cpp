@@ -1,4 +1,11 @@
 // simulate reads uniformly from genes for metaphyler training
+//
+// In adaptive mode (-a), reads of a coarse pilot simulation, and their hits,
+// tell where in each gene the hits change along the gene. Each window between
+// two pilot reads is a stratum: strata where hits change get up to all their
+// reads, the rest as few as one, within a budget of reads per gene. A read
+// that stands for W reads of the uniform simulation is named A_i;size=W,
+// and metaphylerTrain counts its scores W times.
 
 #include <iostream>
 using std::cout;
@@ -14,19 +21,40 @@ using std::istringstream;
 #include <string>
 using std::string;
 
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
 #include <cstdlib>
+#include <cmath>
+
+#include <unistd.h>
+
+#include "hits.h"
 
-typedef unsigned int Uint;
+typedef unsigned int          Uint;
+typedef vector<string>        VS;
+typedef vector<float>         VF;
+typedef map<string, Uint>     S2I;
+typedef map<string, VF>       S2VF;
 
 struct Cmdopts {
-  string fastafile;
+  string fastafile,
+	 pilotfile;      // hits of pilot reads, adaptive mode
   Uint   length,
-         stepsize;
+	 stepsize,
+	 budget,         // reads per gene
+	 coarse;         // pilot reads are coarse * stepsize apart
 };
 
 void helpmsg();
 void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
 void simulate(Uint length, Uint stepsize, string seqid, string &seq);
+void simulate(const Cmdopts &cmdopts, const S2VF &strata, string seqid, string &seq);
+void readPilot(const Cmdopts &cmdopts, S2VF &strata);
+float hitChange(const S2I &hits1, const S2I &hits2);
 
 
 int main(int argc, char *argv[]) {
@@ -36,6 +64,12 @@ int main(int argc, char *argv[]) {
   getcmdopts(argc, argv, cmdopts);
 
 
+  // how much hits change in each stratum of each gene
+  S2VF strata;
+  if (cmdopts.pilotfile != "")
+    readPilot(cmdopts, strata);
+
+
   // open fasta file
   ifstream ifs(cmdopts.fastafile.c_str());
   if (!ifs) {
@@ -51,7 +85,11 @@ int main(int argc, char *argv[]) {
 
     if (eachline[0] == '>') {
       
-      simulate(cmdopts.length, cmdopts.stepsize, seqid, seq); // process previous sequence
+      // process previous sequence
+      if (cmdopts.pilotfile != "")
+	simulate(cmdopts, strata, seqid, seq);
+      else
+	simulate(cmdopts.length, cmdopts.stepsize, seqid, seq);
 
       iss.clear();
       iss.str(eachline);
@@ -64,7 +102,11 @@ int main(int argc, char *argv[]) {
       seq += eachline;   // store sequences
   }
 
-  simulate(cmdopts.length, cmdopts.stepsize, seqid, seq);     // process last sequence
+  // process last sequence
+  if (cmdopts.pilotfile != "")
+    simulate(cmdopts, strata, seqid, seq);
+  else
+    simulate(cmdopts.length, cmdopts.stepsize, seqid, seq);
 
   return 0;
 }
@@ -82,17 +124,185 @@ void simulate(Uint length, Uint stepsize, string seqid, string &seq){
 }
 
 
+// simulate reads from a given sequence, stratum by stratum; stratum i
+// covers the coarse reads of the uniform simulation from pilot read i+1 on
+void simulate(const Cmdopts &cmdopts, const S2VF &strata, string seqid, string &seq) {
+
+  if (seq.length() < cmdopts.length) return;
+
+  Uint nreads  = (seq.length() - cmdopts.length) / cmdopts.stepsize + 1;
+  Uint nstrata = (nreads + cmdopts.coarse - 1) / cmdopts.coarse;
+
+  S2VF::const_iterator siter = strata.find(seqid);
+  VF change(nstrata, 0);
+  if (siter != strata.end())
+    for (Uint i = 0; i < nstrata && i < siter->second.size(); ++i)
+      change[i] = siter->second[i];
+
+  // one read per stratum, a last partial stratum is simulated in full; the
+  // rest of the budget is shared in proportion to how much hits change
+  Uint  base = nstrata - 1 + (nreads - (nstrata-1) * cmdopts.coarse);
+  float total = 0;
+  for (Uint i = 0; i+1 < nstrata; ++i)
+    total += change[i];
+
+  for (Uint i = 0; i < nstrata; ++i) {
+
+    Uint first = i * cmdopts.coarse;
+    Uint n = 1;
+    if (first + cmdopts.coarse > nreads)
+      n = nreads - first;
+    else if (cmdopts.budget > base && total > 0) {
+
+      // reads of a stratum are evenly spaced, so a power of 2 that divides coarse
+      Uint want = 1 + (Uint) ((cmdopts.budget - base) * change[i] / total);
+      while (n*2 <= want && n*2 <= cmdopts.coarse)
+	n *= 2;
+    }
+
+    Uint space  = (nreads - first < cmdopts.coarse) ? 1 : cmdopts.coarse / n;
+    for (Uint j = 0; j < n; ++j) {
+      Uint k   = first + j*space;
+      Uint pos = k * cmdopts.stepsize;
+      cout << ">" << seqid << "_" << k+1;
+      if (space > 1)
+	cout << ";size=" << space;
+      cout << " " << pos+1 << " " << pos+cmdopts.length << endl;
+      cout << seq.substr(pos, cmdopts.length) << endl;
+    }
+  }
+}
+
+
+// best bit score of each pilot read to each reference gene; hits must be
+// grouped by read, as BLAST writes them, and pilot read k of gene A (A_k)
+// starts at (k-1) * coarse * stepsize
+void readPilot(const Cmdopts &cmdopts, S2VF &strata) {
+
+  HitFile hitfile;
+  VS      nomates;
+  if (!hitfile.open(cmdopts.pilotfile, hitFormat(cmdopts.pilotfile), nomates)) {
+    cerr << "Could not open file " << cmdopts.pilotfile << endl;
+    exit(1);
+  }
+  if (hitfile.bycoord) {
+    cerr << "Hits of a read must be next to each other, but " << cmdopts.pilotfile << " is sorted by coordinate;" << endl;
+    cerr << "use name-sorted or collated input (samtools sort -n, samtools collate)" << endl;
+    exit(1);
+  }
+
+  string eachline, qid, lastqid, lastgene, gene;
+  S2I    hits, lasthits;
+  Uint   lastk = 0;
+  off_t  linepos;
+  bool   more = true;
+  while (more) {
+
+    more = hitfile.next(eachline, linepos);
+    if (!more && hitfile.failed) {
+      cerr << "Could not read file " << cmdopts.pilotfile << endl;
+      exit(1);
+    }
+    if (more) {
+      qid = eachline.substr(0, eachline.find('\t'));
+      if (qid == lastqid || lastqid == "") {
+	lastqid = qid;
+	string rid = eachline.substr(qid.size()+1, eachline.find('\t', qid.size()+1) - qid.size()-1);
+	Uint   bit = m8Bits(eachline);
+	Uint  &best = hits[rid];
+	if (bit > best) best = bit;
+	continue;
+      }
+    }
+
+    // all hits of read lastqid are in: compare them with the pilot read before
+    size_t pos = lastqid.rfind('_');
+    if (pos != string::npos) {
+      gene   = lastqid.substr(0, pos);
+      Uint k = atoi(lastqid.c_str() + pos + 1);
+      if (k > 0) {
+	VF &change = strata[gene];
+	if (change.size() < k) change.resize(k, 0);
+
+	// a pilot read between them had no hits at all
+	S2I none;
+	if (gene == lastgene && k == lastk + 1)
+	  change[k-2] = hitChange(lasthits, hits);
+	else if (k > 1) {
+	  change[k-2] = hitChange(none, hits);
+	  if (gene == lastgene && lastk + 1 < k)
+	    change[lastk-1] = hitChange(lasthits, none);
+	}
+	lastgene = gene;
+	lastk    = k;
+	lasthits.swap(hits);
+      }
+    }
+
+    hits.clear();
+    lastqid = qid;
+    if (more) {
+      string rid = eachline.substr(qid.size()+1, eachline.find('\t', qid.size()+1) - qid.size()-1);
+      hits[rid] = m8Bits(eachline);
+    }
+  }
+}
+
+
+// how much the best bit scores to reference genes differ between two
+// reads, from 0 (the same) to 1 (no gene in common)
+float hitChange(const S2I &hits1, const S2I &hits2) {
+
+  float diff = 0, sum = 0;
+  S2I::const_iterator iter1 = hits1.begin(), iter2 = hits2.begin();
+  while (iter1 != hits1.end() || iter2 != hits2.end()) {
+    if (iter2 == hits2.end() || (iter1 != hits1.end() && iter1->first < iter2->first)) {
+      diff += iter1->second;
+      sum  += iter1->second;
+      ++iter1;
+    }
+    else if (iter1 == hits1.end() || iter2->first < iter1->first) {
+      diff += iter2->second;
+      sum  += iter2->second;
+      ++iter2;
+    }
+    else {
+      diff += fabs((float) iter1->second - (float) iter2->second);
+      sum  += iter1->second + iter2->second;
+      ++iter1;
+      ++iter2;
+    }
+  }
+  return sum > 0 ? diff / sum : 0;
+}
+
+
 // parse command line options
 void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
 
-  if (argc != 4) {
+  cmdopts.budget = 0;
+  cmdopts.coarse = 8;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "a:c:p:")) != -1) {
+    switch (opt) {
+    case 'a': cmdopts.budget    = atoi(optarg); break;
+    case 'c': cmdopts.coarse    = atoi(optarg); break;
+    case 'p': cmdopts.pilotfile = optarg; break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+
+  // coarse must be a power of 2, so strata split evenly
+  if (argc - optind != 3 || (cmdopts.pilotfile != "") != (cmdopts.budget > 0)
+      || cmdopts.coarse == 0 || (cmdopts.coarse & (cmdopts.coarse-1)) != 0) {
     helpmsg();
     exit(1);
   }
 
-  cmdopts.length    = atoi(argv[1]);
-  cmdopts.stepsize  = atoi(argv[2]);
-  cmdopts.fastafile = argv[3];
+  cmdopts.length    = atoi(argv[optind]);
+  cmdopts.stepsize  = atoi(argv[optind+1]);
+  cmdopts.fastafile = argv[optind+2];
 }
 
 
@@ -101,12 +311,23 @@ void helpmsg() {
   cerr << endl;
 
   cerr << "Usage:" << endl;
-  cerr << "        ./simuReads <length> <step size> <FASTA file>" << endl;
+  cerr << "        ./simuReads [options] <length> <step size> <FASTA file>" << endl;
+  cerr << endl;
+  cerr << "        Adaptive mode: simulate pilot reads first, and align them as for training," << endl;
+  cerr << "        e.g., for coarse 8 and step size 30," << endl;
+  cerr << "        ./simuReads <length> 240 <FASTA file> > pilot.fasta" << endl;
+  cerr << "        ./simuReads -a <budget> -c 8 -p pilot.blast <length> 30 <FASTA file>" << endl;
   cerr << endl;
 
   cerr << "Options:" << endl;
   cerr << "        <length>     length of reads to be simulated." << endl << endl;
   cerr << "        <step size>  distance between two simulated reads." << endl << endl;
+  cerr << "        -a <budget>  Simulate at most about this many reads per gene, in adaptive mode." << endl;
+  cerr << "                     Each stratum of <coarse> reads gets at least one." << endl << endl;
+  cerr << "        -p <hits>    Hits of pilot reads, simulated <coarse> * <step size> apart:" << endl;
+  cerr << "                     BLAST -m8, SAM, BAM or PAF (.sam, .bam, .paf). Hits of a read must be" << endl;
+  cerr << "                     next to each other, so SAM and BAM are name-sorted or collated." << endl << endl;
+  cerr << "        -c <coarse>  Reads in a stratum, a power of 2 (default: 8)." << endl << endl;
   
   cerr << "Contact:" << endl;
   cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
@@ -0,0 +1,243 @@
+// Compile taxonomy labels of reference genes, and taxonomy names, into one
+// binary database (see taxdb.h) that metaphylerClassify, metaphylerTrain
+// and taxprof map instead of parsing the text files
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+
+#include <sstream>
+using std::istringstream;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+
+#include "taxdb.h"
+
+typedef unsigned int       Uint;
+typedef vector<string>     VS;
+typedef vector<VS>         VVS;
+typedef map<string, Uint>  S2I;
+typedef map<string, string> S2S;
+
+const Uint TLEV = 6;
+
+struct Cmdopts {
+  string dbfile,
+	 taxfile,
+	 tnamesfile;
+};
+
+void helpmsg();
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
+void readTaxFile(string taxfile, VS &ids, VVS &lineages);
+void readNames(string tnamesfile, S2S &names);
+void writeDB(string dbfile, const VS &ids, const VVS &lineages, const S2S &names);
+
+
+int main(int argc, char *argv[]) {
+
+  // read in command line options
+  Cmdopts cmdopts;
+  getcmdopts(argc, argv, cmdopts);
+
+  VS  ids;
+  VVS lineages;
+  readTaxFile(cmdopts.taxfile, ids, lineages);
+
+  S2S names;
+  if (cmdopts.tnamesfile != "")
+    readNames(cmdopts.tnamesfile, names);
+
+  writeDB(cmdopts.dbfile, ids, lineages, names);
+
+  cerr << ids.size() << " genes, " << names.size() << " names in " << cmdopts.dbfile << endl;
+  return 0;
+}
+
+
+// gene ID, and taxonomy labels from the lowest level up, on each line
+void readTaxFile(string taxfile, VS &ids, VVS &lineages) {
+
+  ifstream ifs(taxfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << taxfile << endl;
+    exit(1);
+  }
+
+  string eachline, eachword;
+  istringstream iss;
+  while (getline(ifs, eachline)) {
+    iss.clear();
+    iss.str(eachline);
+    if (!(iss >> eachword)) continue;
+    ids.push_back(eachword);
+    lineages.push_back(VS());
+    while (iss >> eachword)
+      lineages.back().push_back(eachword);
+  }
+}
+
+
+// taxonomy ID, a tab, and its name on each line
+void readNames(string tnamesfile, S2S &names) {
+
+  ifstream ifs(tnamesfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << tnamesfile << endl;
+    exit(1);
+  }
+
+  string eachline;
+  while (getline(ifs, eachline)) {
+    size_t pos = eachline.find('\t');
+    if (pos == string::npos) continue;
+    size_t end = eachline.find_last_not_of(" \t\r");
+    names.insert(S2S::value_type(eachline.substr(0, pos), eachline.substr(pos+1, end-pos)));
+  }
+}
+
+
+// round up to 8 bytes, so every section is aligned
+inline uint64_t align8(uint64_t n) {
+  return (n + 7) & ~(uint64_t)7;
+}
+
+
+// lay out the database and write it; it replaces an old one only once complete
+void writeDB(string dbfile, const VS &ids, const VVS &lineages, const S2S &names) {
+
+  // labels are numbered in sorted order, including names of taxa no gene has
+  S2I lab2num;
+  Uint nlevs = TLEV;
+  for (Uint i = 0; i < lineages.size(); ++i) {
+    nlevs = std::max<Uint>(nlevs, lineages[i].size());
+    for (VS::const_iterator citer = lineages[i].begin(); citer != lineages[i].end(); ++citer)
+      if (*citer != "NA") lab2num[*citer] = 0;
+  }
+  for (S2S::const_iterator citer = names.begin(); citer != names.end(); ++citer)
+    lab2num[citer->first] = 0;
+  Uint nlabels = 0;
+  for (S2I::iterator iter = lab2num.begin(); iter != lab2num.end(); ++iter)
+    iter->second = nlabels++;
+
+
+  // string pool
+  string strs;
+  vector<TaxdbGene>  genes(ids.size());
+  vector<TaxdbLabel> labels(nlabels);
+  vector<Uint>       lins, levnames(nlevs);
+  for (Uint i = 0; i < ids.size(); ++i) {
+    genes[i].idoff  = strs.size();
+    genes[i].linoff = lins.size();
+    genes[i].nlabs  = lineages[i].size();
+    strs.append(ids[i].c_str(), ids[i].size()+1);
+    for (VS::const_iterator citer = lineages[i].begin(); citer != lineages[i].end(); ++citer)
+      lins.push_back(*citer == "NA" ? TAXDBNONE : lab2num[*citer]);
+  }
+  for (S2I::const_iterator citer = lab2num.begin(); citer != lab2num.end(); ++citer) {
+    TaxdbLabel &label = labels[citer->second];
+    label.stroff = strs.size();
+    strs.append(citer->first.c_str(), citer->first.size()+1);
+    S2S::const_iterator niter = names.find(citer->first);
+    label.nameoff = niter == names.end() ? TAXDBNONE : strs.size();
+    if (niter != names.end())
+      strs.append(niter->second.c_str(), niter->second.size()+1);
+  }
+  for (Uint lev = 0; lev < nlevs; ++lev) {
+    levnames[lev] = strs.size();
+    string name = levname(lev);
+    strs.append(name.c_str(), name.size()+1);
+  }
+
+  vector<Uint> order(ids.size());
+  for (Uint i = 0; i < order.size(); ++i) order[i] = i;
+  GeneLess less = {&ids};
+  std::stable_sort(order.begin(), order.end(), less);
+
+
+  // sections
+  TaxdbHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, TAXDBMAGIC, sizeof(hdr.magic));
+  hdr.ngenes   = ids.size();
+  hdr.nlabels  = nlabels;
+  hdr.nlevs    = nlevs;
+  hdr.geneoff  = align8(sizeof(hdr));
+  hdr.orderoff = align8(hdr.geneoff  + genes.size()  * sizeof(TaxdbGene));
+  hdr.linoff   = align8(hdr.orderoff + order.size()  * sizeof(Uint));
+  hdr.laboff   = align8(hdr.linoff   + lins.size()   * sizeof(Uint));
+  hdr.levoff   = align8(hdr.laboff   + labels.size() * sizeof(TaxdbLabel));
+  hdr.stroff   = align8(hdr.levoff   + levnames.size() * sizeof(Uint));
+  hdr.size     = hdr.stroff + strs.size();
+
+  vector<char> image(hdr.size, 0);
+  memcpy(&image[0], &hdr, sizeof(hdr));
+  if (!genes.empty())  memcpy(&image[hdr.geneoff],  &genes[0],  genes.size()  * sizeof(TaxdbGene));
+  if (!order.empty())  memcpy(&image[hdr.orderoff], &order[0],  order.size()  * sizeof(Uint));
+  if (!lins.empty())   memcpy(&image[hdr.linoff],   &lins[0],   lins.size()   * sizeof(Uint));
+  if (!labels.empty()) memcpy(&image[hdr.laboff],   &labels[0], labels.size() * sizeof(TaxdbLabel));
+  memcpy(&image[hdr.levoff], &levnames[0], levnames.size() * sizeof(Uint));
+  memcpy(&image[hdr.stroff], strs.data(), strs.size());
+
+  string tmpfile = dbfile + ".tmp";
+  ofstream ofs(tmpfile.c_str(), std::ios::binary);
+  ofs.write(&image[0], image.size());
+  ofs.close();
+  if (!ofs || rename(tmpfile.c_str(), dbfile.c_str()) != 0) {
+    cerr << "Could not write file " << dbfile << endl;
+    exit(1);
+  }
+}
+
+
+// parse command line options
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
+
+  if (argc != 3 && argc != 4) {
+    helpmsg();
+    exit(1);
+  }
+
+  cmdopts.dbfile     = argv[1];
+  cmdopts.taxfile    = argv[2];
+  cmdopts.tnamesfile = argc == 4 ? argv[3] : "";
+}
+
+
+// print out usage help message
+void helpmsg() {
+  cerr << endl;
+
+  cerr << "Usage:" << endl;
+  cerr << "        ./taxdb <database> <taxonomy file> [<taxonomy names>]" << endl;
+  cerr << endl;
+  cerr << "        Compile taxonomy files into a database, which metaphylerClassify," << endl;
+  cerr << "        metaphylerTrain and taxprof take in place of <taxonomy file> and" << endl;
+  cerr << "        <taxonomy names>." << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "        <database>        Output file (e.g., markers.taxdb)." << endl << endl;
+  cerr << "        <taxonomy file>   Taxonomy labels of reference genes (e.g., markers.taxonomy)." << endl << endl;
+  cerr << "        <taxonomy names>  1st column, taxonomy ID; 2nd, name (e.g., tid2name.tab)." << endl << endl;
+
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
+}
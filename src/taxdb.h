@@ -0,0 +1,460 @@
+// Compiled taxonomy database, written by taxdb from the taxonomy labels of
+// reference genes (e.g., markers.taxonomy) and taxonomy names (tid2name.tab).
+// The file is mapped read-only, so tools look up genes, lineages and names
+// without parsing text, and all of them share one numbering of labels.
+// Layout: header, genes (in input order), gene index sorted by ID,
+// lineages, labels sorted by string, level names, strings.
+// Taxonomy and TaxNames read either a database or the text files, and
+// number genes and labels the same way for both. Lineages, level names and
+// profile files shared by the tools are here too.
+
+#ifndef TAXDB_H
+#define TAXDB_H
+
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char TAXDBMAGIC[8] = {'M', 'P', 'H', 'Y', 'T', 'A', 'X', '1'};
+const unsigned TAXDBNONE = ~0u;      // NA in a lineage, or a label without name
+
+struct TaxdbHeader {
+  char     magic[8];
+  uint64_t size;           // bytes of the whole file
+  uint64_t geneoff, orderoff, linoff, laboff, levoff, stroff;
+  unsigned ngenes, nlabels, nlevs;
+};
+
+struct TaxdbGene {
+  unsigned idoff;          // gene ID in string pool
+  unsigned linoff;         // first label of its lineage, lowest level first
+  unsigned nlabs;
+};
+
+struct TaxdbLabel {
+  unsigned stroff;         // label, e.g., a taxonomy ID
+  unsigned nameoff;        // its name, TAXDBNONE if it has none
+};
+
+struct Taxdb {
+  const char        *base;
+  size_t            size;
+  const TaxdbHeader *hdr;
+  const TaxdbGene   *genes;
+  const unsigned    *order;      // genes sorted by ID
+  const unsigned    *lineages;   // label numbers, TAXDBNONE for NA
+  const TaxdbLabel  *labels;
+  const unsigned    *levnames;
+  const char        *strs;
+
+  Taxdb() : base(NULL), size(0) {}
+  ~Taxdb() { if (base) munmap((void *) base, size); }
+
+  // map a database; 1 if mapped, 0 if the file is not one (e.g., a text
+  // taxonomy file, or no file at all), -1 if it is a truncated or corrupt one
+  int open(const std::string &file) {
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) return 0;
+
+    char magic[8];
+    if (pread(fd, magic, sizeof(magic), 0) != (ssize_t) sizeof(magic)
+	|| memcmp(magic, TAXDBMAGIC, sizeof(magic)) != 0) {
+      close(fd);
+      return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(TaxdbHeader)) {
+      close(fd);
+      return -1;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return -1;
+
+    base     = (const char *) addr;
+    size     = st.st_size;
+    hdr      = (const TaxdbHeader *) base;
+    genes    = (const TaxdbGene *)  (base + hdr->geneoff);
+    order    = (const unsigned *)   (base + hdr->orderoff);
+    lineages = (const unsigned *)   (base + hdr->linoff);
+    labels   = (const TaxdbLabel *) (base + hdr->laboff);
+    levnames = (const unsigned *)   (base + hdr->levoff);
+    strs     = base + hdr->stroff;
+    return valid() ? 1 : -1;
+  }
+
+  // every section, string and number of the mapped file is within bounds
+  bool valid() const {
+
+    if (hdr->size != size || !within(hdr->geneoff, hdr->ngenes, sizeof(TaxdbGene))
+	|| !within(hdr->orderoff, hdr->ngenes, sizeof(unsigned))
+	|| hdr->linoff > hdr->laboff || !within(hdr->linoff, 0, 1)
+	|| !within(hdr->laboff, hdr->nlabels, sizeof(TaxdbLabel))
+	|| !within(hdr->levoff, hdr->nlevs, sizeof(unsigned))
+	|| hdr->stroff >= size || base[size-1] != '\0')
+      return false;
+
+    uint64_t nlins = (hdr->laboff - hdr->linoff) / sizeof(unsigned);
+    uint64_t nstrs = size - hdr->stroff;
+    for (unsigned gene = 0; gene < hdr->ngenes; ++gene) {
+      if (genes[gene].idoff >= nstrs || order[gene] >= hdr->ngenes
+	  || (uint64_t) genes[gene].linoff + genes[gene].nlabs > nlins)
+	return false;
+      for (unsigned lev = 0; lev < genes[gene].nlabs; ++lev)
+	if (labelAt(gene, lev) >= hdr->nlabels && labelAt(gene, lev) != TAXDBNONE)
+	  return false;
+    }
+    for (unsigned lab = 0; lab < hdr->nlabels; ++lab)
+      if (labels[lab].stroff >= nstrs || (labels[lab].nameoff >= nstrs && labels[lab].nameoff != TAXDBNONE))
+	return false;
+    for (unsigned lev = 0; lev < hdr->nlevs; ++lev)
+      if (levnames[lev] >= nstrs)
+	return false;
+    return true;
+  }
+
+  // n items of a size at off fit in the file
+  bool within(uint64_t off, uint64_t n, uint64_t itemsize) const {
+    return off <= size && n * itemsize <= size - off;
+  }
+
+  unsigned ngenes()  const { return hdr->ngenes; }
+  unsigned nlabels() const { return hdr->nlabels; }
+  unsigned nlevs()   const { return hdr->nlevs; }
+
+  const char *geneID(unsigned gene) const { return strs + genes[gene].idoff; }
+  unsigned nlabs(unsigned gene)     const { return genes[gene].nlabs; }
+
+  // label number of a gene at a level, TAXDBNONE for NA
+  unsigned labelAt(unsigned gene, unsigned lev) const { return lineages[genes[gene].linoff + lev]; }
+
+  const char *label(unsigned lab) const { return strs + labels[lab].stroff; }
+
+  // label of a gene at a level, "NA" if it has none
+  const char *label(unsigned gene, unsigned lev) const {
+    unsigned lab = labelAt(gene, lev);
+    return lab == TAXDBNONE ? "NA" : label(lab);
+  }
+
+  // name of a label, NULL if it has none
+  const char *name(unsigned lab) const {
+    return labels[lab].nameoff == TAXDBNONE ? NULL : strs + labels[lab].nameoff;
+  }
+
+  const char *levelName(unsigned lev) const { return strs + levnames[lev]; }
+
+  // gene number of an ID, -1 if not found
+  int findGene(const char *id) const {
+    unsigned lo = 0, hi = hdr->ngenes;
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+      int cmp = strcmp(geneID(order[mid]), id);
+      if (cmp == 0) return order[mid];
+      cmp < 0 ? lo = mid + 1 : hi = mid;
+    }
+    return -1;
+  }
+
+  // label number of a label, -1 if not found
+  int findLabel(const char *lab) const {
+    unsigned lo = 0, hi = hdr->nlabels;
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+      int cmp = strcmp(label(mid), lab);
+      if (cmp == 0) return mid;
+      cmp < 0 ? lo = mid + 1 : hi = mid;
+    }
+    return -1;
+  }
+};
+
+// orders gene numbers by gene ID
+struct GeneLess {
+  const std::vector<std::string> *ids;
+  bool operator()(unsigned a, unsigned b) const { return (*ids)[a] < (*ids)[b]; }
+};
+
+
+// labels of reference genes, mapped from a database, or read from a text
+// taxonomy file (gene ID, then labels from the lowest level up) and numbered
+// as taxdb would number them: labels in sorted order, NA as TAXDBNONE
+class Taxonomy {
+public:
+  Taxonomy() : isdb(false) {}
+
+  // 1 if read, 0 if the file could not be opened, -1 if it is a corrupt
+  // database; err says which
+  int read(const std::string &file, std::string &err) {
+
+    int ret = db.open(file);
+    if (ret < 0) {
+      err = "Corrupt taxonomy database " + file;
+      return -1;
+    }
+    if (ret > 0) {
+      isdb = true;
+      return 1;
+    }
+
+    std::ifstream ifs(file.c_str());
+    if (!ifs) {
+      err = "Could not open file " + file;
+      return 0;
+    }
+
+    // labels are numbered as they are seen, then renumbered in sorted order
+    std::map<std::string, unsigned> lab2num;
+    std::string eachline, eachword;
+    std::istringstream iss;
+    while (getline(ifs, eachline)) {
+      iss.clear();
+      iss.str(eachline);
+      if (!(iss >> eachword)) continue;
+      ids.push_back(eachword);
+      linoffs.push_back(lins.size());
+      while (iss >> eachword) {
+	if (eachword == "NA") {
+	  lins.push_back(TAXDBNONE);
+	  continue;
+	}
+	std::pair<std::map<std::string, unsigned>::iterator, bool> ins =
+	  lab2num.insert(std::map<std::string, unsigned>::value_type(eachword, lab2num.size()));
+	lins.push_back(ins.first->second);
+      }
+    }
+    linoffs.push_back(lins.size());
+
+    std::vector<unsigned> renum(lab2num.size());
+    for (std::map<std::string, unsigned>::const_iterator citer = lab2num.begin(); citer != lab2num.end(); ++citer) {
+      renum[citer->second] = labs.size();
+      labs.push_back(citer->first);
+    }
+    for (std::vector<unsigned>::iterator iter = lins.begin(); iter != lins.end(); ++iter)
+      if (*iter != TAXDBNONE) *iter = renum[*iter];
+
+    order.resize(ids.size());
+    for (unsigned i = 0; i < order.size(); ++i) order[i] = i;
+    GeneLess less = {&ids};
+    std::stable_sort(order.begin(), order.end(), less);
+    return 1;
+  }
+
+  unsigned ngenes()  const { return isdb ? db.ngenes() : ids.size(); }
+  unsigned nlabels() const { return isdb ? db.nlabels() : labs.size(); }
+
+  const char *geneID(unsigned gene) const { return isdb ? db.geneID(gene) : ids[gene].c_str(); }
+  unsigned nlabs(unsigned gene) const { return isdb ? db.nlabs(gene) : linoffs[gene+1] - linoffs[gene]; }
+
+  // gene number of the i-th gene in ID order
+  unsigned sorted(unsigned i) const { return isdb ? db.order[i] : order[i]; }
+
+  // label number of a gene at a level, TAXDBNONE for NA
+  unsigned labelAt(unsigned gene, unsigned lev) const {
+    return isdb ? db.labelAt(gene, lev) : lins[linoffs[gene] + lev];
+  }
+
+  const char *label(unsigned lab) const { return isdb ? db.label(lab) : labs[lab].c_str(); }
+
+  // label of a gene at a level, "NA" if it has none
+  const char *label(unsigned gene, unsigned lev) const {
+    unsigned lab = labelAt(gene, lev);
+    return lab == TAXDBNONE ? "NA" : label(lab);
+  }
+
+  // gene number of an ID, the first gene of a repeated one, -1 if not found
+  int findGene(const char *id) const {
+    unsigned lo = 0, hi = ngenes();
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+      strcmp(geneID(sorted(mid)), id) < 0 ? lo = mid + 1 : hi = mid;
+    }
+    return lo < ngenes() && strcmp(geneID(sorted(lo)), id) == 0 ? (int) sorted(lo) : -1;
+  }
+
+  // label number of a label, -1 if not found
+  int findLabel(const char *lab) const {
+    unsigned lo = 0, hi = nlabels();
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+      int cmp = strcmp(label(mid), lab);
+      if (cmp == 0) return mid;
+      cmp < 0 ? lo = mid + 1 : hi = mid;
+    }
+    return -1;
+  }
+
+private:
+  Taxdb                    db;
+  bool                     isdb;
+  std::vector<std::string> ids, labs;
+  std::vector<unsigned>    linoffs;   // first label of each gene, and the end
+  std::vector<unsigned>    lins;
+  std::vector<unsigned>    order;     // genes sorted by ID
+};
+
+
+// names of labels, looked up in a database, or read from a text file of a
+// label and its name on each line; names are cut at the first blank
+class TaxNames {
+public:
+  TaxNames() : isdb(false) {}
+
+  // 1 if read, 0 if the file could not be opened, -1 if it is a corrupt
+  // database; err says which
+  int read(const std::string &file, std::string &err) {
+
+    int ret = db.open(file);
+    if (ret < 0) {
+      err = "Corrupt taxonomy database " + file;
+      return -1;
+    }
+    if (ret > 0) {
+      isdb = true;
+      return 1;
+    }
+
+    std::ifstream ifs(file.c_str());
+    if (!ifs) {
+      err = "Could not open file " + file;
+      return 0;
+    }
+
+    std::string eachline, lab, name;
+    std::istringstream iss;
+    while (getline(ifs, eachline)) {
+      iss.clear();
+      iss.str(eachline);
+      if (iss >> lab >> name)
+	names.insert(std::map<std::string, std::string>::value_type(lab, name));
+    }
+    return 1;
+  }
+
+  // name of a label, the label itself if it has none
+  std::string name(const std::string &lab) const {
+    if (isdb) {
+      int num = db.findLabel(lab.c_str());
+      const char *name = num < 0 ? NULL : db.name(num);
+      return name ? std::string(name, strcspn(name, " \t")) : lab;
+    }
+    std::map<std::string, std::string>::const_iterator citer = names.find(lab);
+    return citer != names.end() ? citer->second : lab;
+  }
+
+private:
+  Taxdb                              db;
+  bool                               isdb;
+  std::map<std::string, std::string> names;
+};
+
+// read a taxonomy, and number its distinct lineages: gene2lin has the lineage
+// of each gene, lineages the labels of each, lowest level first
+// returns false on errors, described in err
+inline bool readLineages(const std::string &taxfile, Taxonomy &tax, std::vector<unsigned> &gene2lin,
+			 std::vector<std::vector<std::string> > &lineages, std::string &err) {
+
+  if (tax.read(taxfile, err) <= 0)
+    return false;
+
+  std::map<std::vector<unsigned>, unsigned> lin2num;
+  std::vector<unsigned> labs;
+  gene2lin.resize(tax.ngenes());
+  for (unsigned gene = 0; gene < tax.ngenes(); ++gene) {
+    labs.resize(tax.nlabs(gene));
+    for (unsigned lev = 0; lev < labs.size(); ++lev)
+      labs[lev] = tax.labelAt(gene, lev);
+    std::pair<std::map<std::vector<unsigned>, unsigned>::iterator, bool> ins =
+      lin2num.insert(std::map<std::vector<unsigned>, unsigned>::value_type(labs, lineages.size()));
+    if (ins.second) {
+      lineages.push_back(std::vector<std::string>());
+      for (unsigned lev = 0; lev < labs.size(); ++lev)
+	lineages.back().push_back(tax.label(gene, lev));
+    }
+    gene2lin[gene] = ins.first->second;
+  }
+  return true;
+}
+
+
+// name of a taxonomic level, levels above phylum are numbered
+inline std::string levname(unsigned lev) {
+
+  const char *levnames[] = {"species", "genus", "family", "order", "class", "phylum"};
+  if (lev < sizeof(levnames) / sizeof(levnames[0]))
+    return levnames[lev];
+
+  char name[16];
+  snprintf(name, sizeof(name), "level%u", lev+1);
+  return name;
+}
+
+
+// write a profile of n reads, a file of each level (e.g., prefix.genus.taxprof):
+// reads of each name, and of none as Other, with their 95% confidence
+// intervals if ci computes them. Counts may be expected reads: they are
+// rounded, and names with less than half a read are left to Other. A file is
+// replaced only once complete, so it may be read while being rewritten.
+// returns false on errors, described in err
+template <class Count>
+bool printtaxprof(const std::vector<std::map<std::string, Count> > &taxprof, Count n, const std::string &prefix,
+		  std::string &err, void (*ci)(uint64_t, uint64_t, float &, float &) = NULL) {
+
+  for (unsigned lev = 0; lev < taxprof.size(); ++lev) {
+    if (taxprof[lev].empty()) continue;
+
+    std::string outfile = prefix + "." + levname(lev) + ".taxprof";
+    std::string tmpfile = outfile + ".tmp";
+    std::ofstream ofs(tmpfile.c_str());
+    if (!ofs) {
+      err = "Could not open file " + outfile;
+      return false;
+    }
+    ofs.setf(std::ios_base::fixed);
+    ofs.precision(2);
+    Count sum = 0;
+    float low, high;
+    ofs << "Name\t% Abundance\t# reads" << (ci ? "\t95% CI" : "") << std::endl;
+    for (typename std::map<std::string, Count>::const_iterator citer = taxprof[lev].begin(); citer != taxprof[lev].end(); ++citer) {
+      if (citer->second < 0.5) continue;
+      uint64_t reads = (uint64_t) (citer->second + 0.5);
+      ofs << citer->first << "\t" << citer->second*100.0/n << "\t" << reads;
+      if (ci) {
+	ci(reads, (uint64_t) (n + 0.5), low, high);
+	ofs << "\t" << low << "-" << high;
+      }
+      ofs << std::endl;
+      sum += citer->second;
+    }
+    if (sum < n && n - sum >= 0.5) {
+      uint64_t reads = (uint64_t) (n - sum + 0.5);
+      ofs << "Other\t" << (n-sum)*100.0/n << "\t" << reads;
+      if (ci) {
+	ci(reads, (uint64_t) (n + 0.5), low, high);
+	ofs << "\t" << low << "-" << high;
+      }
+      ofs << std::endl;
+    }
+    ofs.close();
+    if (!ofs || rename(tmpfile.c_str(), outfile.c_str()) != 0) {
+      err = "Could not write file " + outfile;
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,375 @@
+// Merge taxonomy profiles of many samples into one taxon by sample table
+
+#include <iostream>
+using std::cout;
+using std::endl;
+using std::cerr;
+
+#include <fstream>
+using std::ifstream;
+
+#include <sstream>
+using std::istringstream;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <pthread.h>
+
+typedef unsigned int Uint;
+typedef vector<string>      VS;
+typedef map<string, Uint>   S2I;
+
+// one nonzero entry of the matrix
+struct Entry {
+  Uint   taxon, sample;
+  string pct;              // kept as written in the taxprof file
+  Uint   num;
+};
+typedef vector<Entry> VE;
+
+// entries of one taxprof file, before taxa are numbered
+struct Record {
+  string taxon, pct;
+  Uint   num;
+};
+typedef vector<Record> VR;
+
+struct Cmdopts {
+  VS     files;
+  string matrix;           // existing sparse matrix to add samples to
+  bool   sparse;           // output format
+  Uint   nthreads;
+};
+
+// files read by one thread
+struct Job {
+  const VS  *files;
+  Uint      next, step;    // this thread reads files next, next+step, ...
+  vector<VR> *records;
+};
+
+// sparse matrix: names of taxa and samples, and nonzero entries
+struct Matrix {
+  VS  taxa, samples;
+  S2I taxon2idx, sample2idx;
+  VE  entries;
+};
+
+void helpmsg();
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
+void readMatrix(string matrixfile, Matrix &matrix);
+void readProfiles(const Cmdopts &cmdopts, vector<VR> &records);
+void *readJob(void *arg);
+void readProfile(string file, VR &records);
+string sampleName(const string &file);
+void addProfiles(const Cmdopts &cmdopts, const vector<VR> &records, Matrix &matrix);
+Uint index(const string &name, VS &names, S2I &name2idx);
+void printDense(const Matrix &matrix);
+void printSparse(const Matrix &matrix);
+
+
+int main(int argc, char *argv[]) {
+
+  // read in command line options
+  Cmdopts cmdopts;
+  getcmdopts(argc, argv, cmdopts);
+
+
+  // samples merged before
+  Matrix matrix;
+  if (!cmdopts.matrix.empty())
+    readMatrix(cmdopts.matrix, matrix);
+
+
+  // read in new samples in parallel, and add them in the order given
+  vector<VR> records(cmdopts.files.size());
+  readProfiles(cmdopts, records);
+  addProfiles(cmdopts, records, matrix);
+
+
+  cmdopts.sparse ? printSparse(matrix) : printDense(matrix);
+
+  return 0;
+}
+
+
+// read taxprof files, each thread takes every nthreads-th file
+void readProfiles(const Cmdopts &cmdopts, vector<VR> &records) {
+
+  Uint nthreads = std::min(cmdopts.nthreads, (Uint) cmdopts.files.size());
+  if (nthreads == 0) return;
+
+  vector<Job> jobs(nthreads);
+  vector<pthread_t> threads(nthreads);
+  for (Uint i = 0; i < nthreads; ++i) {
+    Job job = {&cmdopts.files, i, nthreads, &records};
+    jobs[i] = job;
+    if (i > 0 && pthread_create(&threads[i], NULL, readJob, &jobs[i]) != 0) {
+      cerr << "Could not create thread" << endl;
+      exit(1);
+    }
+  }
+  readJob(&jobs[0]);
+  for (Uint i = 1; i < nthreads; ++i)
+    pthread_join(threads[i], NULL);
+}
+
+
+void *readJob(void *arg) {
+
+  Job &job = *(Job *) arg;
+  for (Uint i = job.next; i < job.files->size(); i += job.step)
+    readProfile((*job.files)[i], (*job.records)[i]);
+  return NULL;
+}
+
+
+// read one taxprof file: name, % abundance, # reads
+void readProfile(string file, VR &records) {
+
+  ifstream ifs(file.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << file << endl;
+    exit(1);
+  }
+
+  string eachline;
+  while (getline(ifs, eachline)) {
+
+    if (eachline.compare(0, 4, "Name") == 0) continue; // header
+
+    size_t pos1 = eachline.find('\t');
+    if (pos1 == string::npos) continue;
+    size_t pos2 = eachline.find('\t', pos1+1);
+
+    Record record;
+    record.taxon = eachline.substr(0, pos1);
+    record.pct   = eachline.substr(pos1+1, pos2 == string::npos ? string::npos : pos2-pos1-1);
+    record.num   = pos2 == string::npos ? 0 : atoi(eachline.c_str() + pos2 + 1);
+    records.push_back(record);
+  }
+}
+
+
+// sample name is the file name up to the first '.', e.g., sample1.genus.taxprof
+string sampleName(const string &file) {
+
+  size_t pos = file.find('.', 1);
+  size_t ws  = file.find_first_of(" \t\n");
+  if (ws != string::npos && (pos == string::npos || ws < pos))
+    pos = string::npos;
+  return pos == string::npos ? file : file.substr(0, pos);
+}
+
+
+// number taxa and samples, and add entries
+// a sample merged before is replaced; if several files have the same
+// sample name, the later file wins for taxa found in both
+void addProfiles(const Cmdopts &cmdopts, const vector<VR> &records, Matrix &matrix) {
+
+  map<Uint, bool> replaced;
+  vector<Uint> fsamples(records.size());
+  Uint nold = matrix.samples.size();
+  for (Uint i = 0; i < records.size(); ++i) {
+    fsamples[i] = index(sampleName(cmdopts.files[i]), matrix.samples, matrix.sample2idx);
+    if (fsamples[i] < nold) replaced[fsamples[i]] = true;
+  }
+  if (!replaced.empty()) {
+    VE kept;
+    for (VE::const_iterator citer = matrix.entries.begin(); citer != matrix.entries.end(); ++citer)
+      if (replaced.find(citer->sample) == replaced.end())
+	kept.push_back(*citer);
+    matrix.entries.swap(kept);
+  }
+
+  // taxon and sample of an entry, to its position in entries
+  map<std::pair<Uint, Uint>, size_t> cell2entry;
+  for (size_t i = 0; i < matrix.entries.size(); ++i)
+    cell2entry[std::make_pair(matrix.entries[i].taxon, matrix.entries[i].sample)] = i;
+
+  for (Uint i = 0; i < records.size(); ++i) {
+    for (VR::const_iterator citer = records[i].begin(); citer != records[i].end(); ++citer) {
+      Entry entry = {index(citer->taxon, matrix.taxa, matrix.taxon2idx), fsamples[i], citer->pct, citer->num};
+      std::pair<Uint, Uint> cell(entry.taxon, entry.sample);
+      map<std::pair<Uint, Uint>, size_t>::const_iterator eiter = cell2entry.find(cell);
+      if (eiter != cell2entry.end())
+	matrix.entries[eiter->second] = entry;
+      else {
+	cell2entry[cell] = matrix.entries.size();
+	matrix.entries.push_back(entry);
+      }
+    }
+  }
+}
+
+
+// index of a name, a new one is added at the end
+Uint index(const string &name, VS &names, S2I &name2idx) {
+
+  S2I::const_iterator citer = name2idx.find(name);
+  if (citer != name2idx.end())
+    return citer->second;
+  name2idx.insert(S2I::value_type(name, names.size()));
+  names.push_back(name);
+  return names.size() - 1;
+}
+
+
+// tab-delimited table, taxa by samples, both sorted by name
+void printDense(const Matrix &matrix) {
+
+  // positions of samples in sorted order
+  vector<Uint> col(matrix.samples.size());
+  Uint ncols = 0;
+  cout << "\t";
+  for (S2I::const_iterator citer = matrix.sample2idx.begin(); citer != matrix.sample2idx.end(); ++citer) {
+    col[citer->second] = ncols++;
+    cout << (ncols > 1 ? "\t" : "") << citer->first;
+  }
+  cout << "\n";
+
+  // entries of each taxon
+  vector<vector<const Entry *> > rows(matrix.taxa.size());
+  for (VE::const_iterator citer = matrix.entries.begin(); citer != matrix.entries.end(); ++citer)
+    rows[citer->taxon].push_back(&*citer);
+
+  vector<const string *> cells(ncols);
+  for (S2I::const_iterator citer = matrix.taxon2idx.begin(); citer != matrix.taxon2idx.end(); ++citer) {
+    const vector<const Entry *> &row = rows[citer->second];
+    if (row.empty()) continue;
+    fill(cells.begin(), cells.end(), (const string *) NULL);
+    for (Uint i = 0; i < row.size(); ++i)
+      cells[col[row[i]->sample]] = &row[i]->pct;
+
+    cout << citer->first << "\t";
+    for (Uint i = 0; i < ncols; ++i)
+      cout << (cells[i] ? *cells[i] : "0.00") << "\t";
+    cout << "\n";
+  }
+}
+
+
+// sparse matrix, can be read back in with -a to add more samples
+// #sample <index> <name>, #taxon <index> <name>, then one line for each
+// nonzero entry: <taxon index> <sample index> <% abundance> <# reads>
+void printSparse(const Matrix &matrix) {
+
+  cout << "#taxmatrix\t" << matrix.samples.size() << "\t" << matrix.taxa.size() << "\t" << matrix.entries.size() << "\n";
+  for (Uint i = 0; i < matrix.samples.size(); ++i)
+    cout << "#sample\t" << i << "\t" << matrix.samples[i] << "\n";
+  for (Uint i = 0; i < matrix.taxa.size(); ++i)
+    cout << "#taxon\t" << i << "\t" << matrix.taxa[i] << "\n";
+  for (VE::const_iterator citer = matrix.entries.begin(); citer != matrix.entries.end(); ++citer)
+    cout << citer->taxon << "\t" << citer->sample << "\t" << citer->pct << "\t" << citer->num << "\n";
+}
+
+
+// read in a sparse matrix written by printSparse
+void readMatrix(string matrixfile, Matrix &matrix) {
+
+  ifstream ifs(matrixfile.c_str());
+  if (!ifs) {
+    cerr << "Could not open file " << matrixfile << endl;
+    exit(1);
+  }
+
+  string eachline, eachword, name;
+  istringstream iss;
+  if (!getline(ifs, eachline) || eachline.compare(0, 10, "#taxmatrix") != 0) {
+    cerr << matrixfile << " is not a sparse matrix from taxmatrix" << endl;
+    exit(1);
+  }
+
+  while (getline(ifs, eachline)) {
+
+    iss.clear();
+    iss.str(eachline);
+
+    if (eachline[0] == '#') {
+      Uint idx;
+      iss >> eachword >> idx;
+      getline(iss, name);
+      name.erase(0, 1); // tab before name
+      if (eachword == "#sample")
+	index(name, matrix.samples, matrix.sample2idx);
+      else
+	index(name, matrix.taxa, matrix.taxon2idx);
+    }
+    else {
+      Entry entry;
+      iss >> entry.taxon >> entry.sample >> entry.pct >> entry.num;
+      if (entry.taxon >= matrix.taxa.size() || entry.sample >= matrix.samples.size()) {
+	cerr << "Bad entry in " << matrixfile << ": " << eachline << endl;
+	exit(1);
+      }
+      matrix.entries.push_back(entry);
+    }
+  }
+}
+
+
+// parse command line options
+void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
+
+  cmdopts.sparse   = false;
+  cmdopts.nthreads = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "a:f:t:")) != -1) {
+    switch (opt) {
+    case 'a': cmdopts.matrix   = optarg; break;
+    case 't': cmdopts.nthreads = atoi(optarg); break;
+    case 'f':
+      if      (string(optarg) == "dense")  cmdopts.sparse = false;
+      else if (string(optarg) == "sparse") cmdopts.sparse = true;
+      else { helpmsg(); exit(1); }
+      break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+  if (cmdopts.nthreads == 0) cmdopts.nthreads = 1;
+
+  for (int i = optind; i < argc; ++i)
+    cmdopts.files.push_back(argv[i]);
+
+  if (cmdopts.files.empty() && cmdopts.matrix.empty()) {
+    helpmsg();
+    exit(1);
+  }
+}
+
+
+// print out usage help message
+void helpmsg() {
+  cerr << endl;
+
+  cerr << "Usage:" << endl;
+  cerr << "        ./taxmatrix [options] <taxprof 1> <taxprof 2> ..." << endl;
+  cerr << endl;
+  cerr << "        Merge taxonomy profiles of multiple samples into one table." << endl;
+  cerr << endl;
+
+  cerr << "Options:" << endl;
+  cerr << "        <taxprof>        Taxonomy profile from program taxprof." << endl;
+  cerr << "                         Sample name is the file name up to the first '.'." << endl << endl;
+  cerr << "        -a <matrix>      Add samples to a sparse matrix written before with -f sparse." << endl;
+  cerr << "                         A sample that is already in it is replaced." << endl << endl;
+  cerr << "        -f <format>      dense:  tab-delimited table of % abundance (default)." << endl;
+  cerr << "                         sparse: nonzero entries only, with % abundance and # reads." << endl << endl;
+  cerr << "        -t <threads>     Number of threads to read taxprof files (default: 1)." << endl << endl;
+
+  cerr << "Contact:" << endl;
+  cerr << "        Have problems? Contact Bo Liu - boliu@umiacs.umd.edu" << endl;
+  cerr << endl;
+}
@@ -2,7 +2,6 @@
 using std::cout;
 using std::endl;
 using std::cerr;
-using std::ios_base;
 
 #include <fstream>
 using std::ifstream;
@@ -20,27 +19,116 @@ using std::vector;
 #include <map>
 using std::map;
 
+#include <unordered_map>
+using std::unordered_map;
+
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <ctime>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "taxdb.h"
 
 typedef unsigned int Uint;
 const Uint TLEV = 6;
+const Uint NONE = ~0u;
+const float ZSCORE = 1.96;   // of 95% confidence intervals
 
 struct Cmdopts {
   string clsffn,
-         prefix,
-         tnamesfn;
-  float  confcut;
+	 prefix,
+	 tnamesfn,
+	 taxfn,
+	 statefn,        // running profile of previous batches
+	 outstatefn,     // counts of this run, to be merged with others
+	 convlevs,       // levels checked for convergence
+	 sampledelims;   // read IDs are split at these into fields, one of which names the sample
+  vector<string> mergefns; // states merged instead of reading a classification
+  float  confcut,
+	 tol;            // negative if convergence is not checked
+  Uint   nthreads,
+	 samplefield,    // 1-based
+	 snapsecs,       // following a growing classification: snapshots every
+	 snapreads;      // so many seconds and reads, 0 if not
+};
+
+typedef vector<string>                VS;
+typedef map<string, Uint>             S2I;
+typedef map<string, uint64_t>         S2L;
+typedef vector<S2L>                   VS2L;
+typedef unordered_map<Uint, uint64_t> I2L;
+typedef vector<I2L>                   VI2L;
+typedef vector<Uint>                  VI;
+typedef vector<uint64_t>              VL;
+
+// taxonomy tree of reference genes: a node for each label at each level,
+// whose parent is the label at the next higher level that is not NA
+struct Tree {
+  Uint nlevs;
+  VI   level, parent;      // of each node, parent is NONE at the top
+  vector<string> label;
+  unordered_map<uint64_t, Uint> tid2node; // level and taxonomy ID
+  S2I  label2node;         // other labels, as "level label"
 };
 
-typedef map<string, string> S2S;
-typedef map<string, Uint>   S2I;
-typedef vector<S2I>         VS2I;
+// read counts of one sample
+// a read counts once, at the node of its lowest classified level;
+// if not in the tree, taxonomy IDs are counted as integers, other labels by name
+struct Counts {
+  VL       nodes;
+  VI2L     tids;
+  VS2L     labels;
+  uint64_t n;
+};
+typedef map<string, Counts> S2C;
+
+// read counts of one chunk of the classification file, by sample
+// ("" if reads are not split into samples)
+struct Chunk {
+  const Cmdopts *cmdopts;
+  const Tree    *tree;
+  off_t begin, end;        // lines starting in [begin, end)
+  S2C   samples;
+  Counts *counts;          // of the sample of the last line
+  string  key;
+};
+
+// profile of one sample: read counts of taxa at each level, and reads counted
+struct Profile {
+  VS2L     abund;
+  uint64_t n;
+};
+typedef map<string, Profile> S2P;
 
 void helpmsg();
 void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts);
-void gettnames(string tnamesfn, S2S &tid2name);
-Uint abundance(const Cmdopts &cmdopts, const S2S &tid2name, VS2I &abund);
-void printtaxprof(const VS2I &taxprof, Uint n, string prefix);
+void readTree(string taxfn, Tree &tree);
+Uint addNode(Tree &tree, Uint lev, const string &label);
+Uint findNode(const Tree &tree, Uint lev, const char *beg, const char *end);
+void abundance(const Cmdopts &cmdopts, const Tree &tree, const TaxNames &tnames, S2P &profiles);
+void resolveNames(const Tree &tree, const TaxNames &tnames, Counts &total, VS2L &abund);
+void *countChunk(void *arg);
+void countLine(Chunk &chunk, const string &eachline);
+void follow(const Cmdopts &cmdopts, const Tree &tree, const TaxNames &tnames);
+void snapshot(const Cmdopts &cmdopts, const Tree &tree, const TaxNames &tnames, const Chunk &chunk);
+void writeProfiles(const Cmdopts &cmdopts, S2P &profiles);
+void sampleKey(const Cmdopts &cmdopts, const char *beg, const char *end, const char *&kbeg, const char *&kend);
+Counts &sampleCounts(Chunk &chunk, const string &key);
+inline bool parseTid(const char *beg, const char *end, Uint &tid);
+inline Uint readWeight(const char *beg, const char *end);
+void readState(string statefn, VS2L &abund, uint64_t &n);
+void writeState(string statefn, const VS2L &abund, uint64_t n);
+void interval(uint64_t count, uint64_t n, float &low, float &high);
+float maxInterval(const VS2L &abund, uint64_t n, const string &convlevs);
 
 int main(int argc, char *argv[]) {
 
@@ -49,117 +137,638 @@ int main(int argc, char *argv[]) {
   getcmdopts(argc, argv, cmdopts);
 
 
-  S2S tid2name;
-  if (cmdopts.tnamesfn != "")
-    gettnames(cmdopts.tnamesfn, tid2name);
+  TaxNames tnames;
+  string   err;
+  if (cmdopts.tnamesfn != "" && tnames.read(cmdopts.tnamesfn, err) <= 0) {
+    cerr << err << endl;
+    exit(1);
+  }
+
 
+  Tree tree;
+  tree.nlevs = TLEV;
+  if (cmdopts.taxfn != "")
+    readTree(cmdopts.taxfn, tree);
 
-  VS2I abund(TLEV, S2I());
-  Uint totaln = abundance(cmdopts, tid2name, abund);
 
-  printtaxprof(abund, totaln, cmdopts.prefix);
-  
+  // a classification still being written: profiles are rewritten as reads come
+  if (cmdopts.snapsecs > 0 || cmdopts.snapreads > 0) {
+    follow(cmdopts, tree, tnames);
+    return 0;
+  }
+
+  // one profile, or one of each sample in a single pass over the reads
+  S2P profiles;
+  if (cmdopts.mergefns.empty())
+    abundance(cmdopts, tree, tnames, profiles);
+  else {
+    Profile &merged = profiles[""];
+    merged.abund.assign(tree.nlevs, S2L());
+    merged.n = 0;
+  }
+
+  // counts of other runs, e.g., shards of a sample on several nodes; states
+  // are exact counts, so they add up to the counts of one run in any order
+  for (VS::const_iterator citer = cmdopts.mergefns.begin(); citer != cmdopts.mergefns.end(); ++citer) {
+    if (access(citer->c_str(), R_OK) != 0) {
+      cerr << "Could not open file " << *citer << endl;
+      exit(1);
+    }
+    readState(*citer, profiles[""].abund, profiles[""].n);
+  }
+
+  writeProfiles(cmdopts, profiles);
   return 0;
 }
 
-void printtaxprof(const VS2I &taxprof, Uint n, string prefix) {
+// write profiles, states and convergence of each sample
+// files of a sample are named with its key after the prefix (or state file)
+void writeProfiles(const Cmdopts &cmdopts, S2P &profiles) {
 
-  vector<string> levnames;
-  levnames.push_back("species");
-  levnames.push_back("genus");
-  levnames.push_back("family");
-  levnames.push_back("order");
-  levnames.push_back("class");
-  levnames.push_back("phylum");
+  for (S2P::iterator piter = profiles.begin(); piter != profiles.end(); ++piter) {
+    VS2L     &abund  = piter->second.abund;
+    uint64_t &totaln = piter->second.n;
+    string   sfx     = piter->first.empty() ? "" : "." + piter->first;
 
+    if (cmdopts.outstatefn != "")
+      writeState(cmdopts.outstatefn + sfx, abund, totaln);
 
-  Uint i = 0;
-  for (VS2I::const_iterator citer1 = taxprof.begin(); citer1 != taxprof.end(); ++citer1, ++i) {
-    if (citer1->empty()) continue;
 
-    string outfile = prefix + "." + levnames[i] + ".taxprof";
-    ofstream ofs(outfile.c_str());
-    ofs.setf(ios_base::fixed);
-    ofs.precision(2);
-    Uint sum = 0;
-    ofs << "Name\t% Abundance\t# reads" << endl;
-    for (S2I::const_iterator citer2 = citer1->begin(); citer2 != citer1->end(); ++citer2) {
-      ofs << citer2->first << "\t" << citer2->second*100.0/n << "\t" << citer2->second << endl;
-      sum += citer2->second;
+    // add counts to the running profile of previous batches
+    if (cmdopts.statefn != "") {
+      readState(cmdopts.statefn + sfx, abund, totaln);
+      writeState(cmdopts.statefn + sfx, abund, totaln);
+    }
+
+    string err;
+    if (cmdopts.prefix != "" && !printtaxprof(abund, totaln, cmdopts.prefix + sfx, err, cmdopts.tol >= 0 ? interval : NULL)) {
+      cerr << err << endl;
+      exit(1);
+    }
+
+
+    // the profile has converged once all confidence intervals are narrow enough
+    if (cmdopts.tol >= 0) {
+      float width = maxInterval(abund, totaln, cmdopts.convlevs);
+      if (!piter->first.empty()) cout << piter->first << "\t";
+      cout << (width <= cmdopts.tol ? "converged" : "running") << "\t" << totaln << "\t" << width << endl;
+    }
+  }
+}
+
+// a count of a state file: all digits up to end, which is a tab or the end of the line
+bool parseCount(const char *p, char end, uint64_t &count) {
+
+  if (*p < '0' || *p > '9') return false;
+  char *pend;
+  errno = 0;
+  count = strtoull(p, &pend, 10);
+  return errno == 0 && *pend == end;
+}
+
+// counts of previous batches: "#taxprof <n>", then "<level> <name> <count>", tab separated
+void readState(string statefn, VS2L &abund, uint64_t &n) {
+
+  ifstream ifs(statefn.c_str());
+  if (!ifs) return;          // first batch
+
+  string eachline;
+  uint64_t count;
+  if (!getline(ifs, eachline) || eachline.compare(0, 9, "#taxprof\t") != 0
+      || !parseCount(eachline.c_str() + 9, '\0', count)) {
+    cerr << "Not a taxprof state file " << statefn << endl;
+    exit(1);
+  }
+  n += count;
+
+  uint64_t lev;
+  while (getline(ifs, eachline)) {
+    size_t pos1 = eachline.find('\t');
+    size_t pos2 = eachline.rfind('\t');
+    if (pos1 == string::npos || pos2 == pos1
+	|| !parseCount(eachline.c_str(), '\t', lev) || lev >= TLEV
+	|| !parseCount(eachline.c_str() + pos2 + 1, '\0', count)) {
+      cerr << "Malformed line in taxprof state file " << statefn << ": " << eachline << endl;
+      exit(1);
+    }
+
+    if (lev >= abund.size()) abund.resize(lev+1);
+    abund[lev][eachline.substr(pos1+1, pos2-pos1-1)] += count;
+  }
+}
+
+// a new state replaces the old one only once it is complete
+void writeState(string statefn, const VS2L &abund, uint64_t n) {
+
+  string tmpfn = statefn + ".tmp";
+  ofstream ofs(tmpfn.c_str());
+  if (!ofs) {
+    cerr << "Could not open file " << tmpfn << endl;
+    exit(1);
+  }
+
+  ofs << "#taxprof\t" << n << "\n";
+  for (Uint lev = 0; lev < abund.size(); ++lev)
+    for (S2L::const_iterator citer = abund[lev].begin(); citer != abund[lev].end(); ++citer)
+      ofs << lev << "\t" << citer->first << "\t" << citer->second << "\n";
+  ofs.close();
+
+  if (!ofs || rename(tmpfn.c_str(), statefn.c_str()) != 0) {
+    cerr << "Could not write file " << statefn << endl;
+    exit(1);
+  }
+}
+
+// Wilson score interval of a proportion, in percent
+void interval(uint64_t count, uint64_t n, float &low, float &high) {
+
+  double p = (double) count / n, z2 = ZSCORE*ZSCORE;
+  double center = (p + z2/(2*n)) / (1 + z2/n);
+  double half   = ZSCORE * sqrt(p*(1-p)/n + z2/(4.0*n*n)) / (1 + z2/n);
+  low  = std::max(0.0, center - half) * 100;
+  high = std::min(1.0, center + half) * 100;
+}
+
+// largest half width of the confidence intervals of taxa at the given levels (all if empty)
+float maxInterval(const VS2L &abund, uint64_t n, const string &convlevs) {
+
+  if (n == 0) return 100;
+
+  float width = 0, low, high;
+  for (Uint lev = 0; lev < abund.size(); ++lev) {
+    if (convlevs != "" && ("," + convlevs + ",").find("," + levname(lev) + ",") == string::npos)
+      continue;
+
+    uint64_t sum = 0;
+    for (S2L::const_iterator citer = abund[lev].begin(); citer != abund[lev].end(); ++citer) {
+      interval(citer->second, n, low, high);
+      width = std::max(width, (high - low) / 2);
+      sum += citer->second;
+    }
+    interval(n - sum, n, low, high);   // Other
+    width = std::max(width, (high - low) / 2);
+  }
+  return width;
+}
+
+// count reads classified at each level, on chunks of the file in parallel
+// counts of tree nodes are added up to their ancestors once all reads are counted
+// names are looked up once per taxon, after counts of all chunks are merged
+void abundance(const Cmdopts &cmdopts, const Tree &tree, const TaxNames &tnames, S2P &profiles) {
+
+  struct stat st;
+  if (stat(cmdopts.clsffn.c_str(), &st) != 0) {
+    cerr << "Could not open file " << cmdopts.clsffn << endl;
+    exit(1);
+  }
+
+  // split the file into one chunk per thread
+  Uint nthreads = cmdopts.nthreads;
+  if (st.st_size < (off_t) (nthreads << 20)) // not worth it for small files
+    nthreads = 1;
+  vector<Chunk> chunks(nthreads);
+  vector<pthread_t> threads(nthreads);
+  for (Uint i = 0; i < nthreads; ++i) {
+    chunks[i].cmdopts = &cmdopts;
+    chunks[i].tree    = &tree;
+    chunks[i].begin   = st.st_size / nthreads * i;
+    chunks[i].end     = i+1 == nthreads ? st.st_size : st.st_size / nthreads * (i+1);
+    if (i > 0 && pthread_create(&threads[i], NULL, countChunk, &chunks[i]) != 0) {
+      cerr << "Could not create thread" << endl;
+      exit(1);
+    }
+  }
+  countChunk(&chunks[0]);
+
+  // merge counts of each sample into the first chunk
+  S2C &totals = chunks[0].samples;
+  for (Uint i = 1; i < nthreads; ++i) {
+    pthread_join(threads[i], NULL);
+    for (S2C::iterator siter = chunks[i].samples.begin(); siter != chunks[i].samples.end(); ++siter) {
+      const Counts &counts = siter->second;
+      S2C::iterator titer = totals.find(siter->first);
+      if (titer == totals.end()) {
+	totals.insert(*siter);
+	continue;
+      }
+      Counts &total = titer->second;
+      for (Uint node = 0; node < total.nodes.size(); ++node)
+	total.nodes[node] += counts.nodes[node];
+      for (Uint lev = 0; lev < tree.nlevs; ++lev) {
+	for (I2L::const_iterator citer = counts.tids[lev].begin(); citer != counts.tids[lev].end(); ++citer)
+	  total.tids[lev][citer->first] += citer->second;
+	for (S2L::const_iterator citer = counts.labels[lev].begin(); citer != counts.labels[lev].end(); ++citer)
+	  total.labels[lev][citer->first] += citer->second;
+      }
+      total.n += counts.n;
+    }
+    chunks[i].samples.clear();
+  }
+
+  for (S2C::iterator siter = totals.begin(); siter != totals.end(); ++siter) {
+    Profile &profile = profiles[siter->first];
+    profile.abund.assign(tree.nlevs, S2L());
+    profile.n = siter->second.n;
+    resolveNames(tree, tnames, siter->second, profile.abund);
+  }
+}
+
+
+// roll up counts of tree nodes, and add counts of all taxa to abund by name
+void resolveNames(const Tree &tree, const TaxNames &tnames, Counts &total, VS2L &abund) {
+
+  // roll up: parents are at higher levels, and nodes are numbered by level
+  for (Uint node = 0; node < total.nodes.size(); ++node) {
+    if (tree.parent[node] != NONE)
+      total.nodes[tree.parent[node]] += total.nodes[node];
+    if (total.nodes[node] > 0)
+      total.labels[tree.level[node]][tree.label[node]] += total.nodes[node];
+  }
+
+  // resolve names; different IDs with the same name are counted together
+  for (Uint lev = 0; lev < tree.nlevs; ++lev) {
+    for (I2L::const_iterator citer = total.tids[lev].begin(); citer != total.tids[lev].end(); ++citer) {
+      char tid[16];
+      snprintf(tid, sizeof(tid), "%u", citer->first);
+      abund[lev][tnames.name(tid)] += citer->second;
     }
-    if (sum < n) {
-      ofs << "Other\t" << (n-sum)*100.0/n << "\t" << n-sum << endl;
+    for (S2L::const_iterator citer = total.labels[lev].begin(); citer != total.labels[lev].end(); ++citer) {
+      abund[lev][tnames.name(citer->first)] += citer->second;
     }
   }
 }
 
-Uint abundance(const Cmdopts &cmdopts, const S2S &tid2name, VS2I &abund) {
 
-  Uint n = 0;
+// the sample key of a read ID: the given field, split at any of the delimiters
+void sampleKey(const Cmdopts &cmdopts, const char *beg, const char *end, const char *&kbeg, const char *&kend) {
+
+  const char *delims = cmdopts.sampledelims.c_str();
+  kbeg = beg;
+  for (Uint field = 1; field < cmdopts.samplefield && kbeg < end; ++field) {
+    while (kbeg < end && !strchr(delims, *kbeg)) ++kbeg;
+    if (kbeg < end) ++kbeg;
+  }
+  kend = kbeg;
+  while (kend < end && !strchr(delims, *kend)) ++kend;
+}
+
+
+// counts of a sample, new ones are empty
+// reads without the key field are counted in sample "unassigned"
+Counts &sampleCounts(Chunk &chunk, const string &key) {
+
+  string name = key.empty() && chunk.cmdopts->sampledelims != "" ? "unassigned" : key;
+  S2C::iterator siter = chunk.samples.find(name);
+  if (siter != chunk.samples.end())
+    return siter->second;
+
+  const Tree &tree = *chunk.tree;
+  Counts &counts = chunk.samples[name];
+  counts.nodes.assign(tree.label.size(), 0);
+  counts.tids.assign(tree.nlevs, I2L());
+  counts.labels.assign(tree.nlevs, S2L());
+  counts.n = 0;
+  return counts;
+}
+
+
+// count reads in lines starting within a chunk of the classification file
+void *countChunk(void *arg) {
+
+  Chunk &chunk = *(Chunk *) arg;
+  const Cmdopts &cmdopts = *chunk.cmdopts;
+  chunk.samples.clear();
+  chunk.counts = cmdopts.sampledelims == "" ? &sampleCounts(chunk, "") : NULL;
+
   ifstream ifs(cmdopts.clsffn.c_str());
   if (!ifs) {
     cerr << "Could not open file " << cmdopts.clsffn << endl;
     exit(1);
   }
 
-  string eachline, eachword, tid;
-  istringstream iss;
-  while (getline(ifs, eachline)) {
+  // a line belongs to the chunk it starts in
+  string eachline;
+  off_t  pos = chunk.begin;
+  if (pos > 0) {
+    ifs.seekg(pos - 1);
+    getline(ifs, eachline);
+    pos += eachline.size();
+  }
+
+  while (pos < chunk.end && getline(ifs, eachline)) {
+    pos += eachline.size() + 1;
+    countLine(chunk, eachline);
+  }
+  return NULL;
+}
+
+
+// count the read of one line of the classification
+void countLine(Chunk &chunk, const string &eachline) {
+
+  const Cmdopts &cmdopts = *chunk.cmdopts;
+  const Tree    &tree    = *chunk.tree;
+  const char *p = eachline.c_str(), *lend = p + eachline.size();
 
-    iss.clear();
-    iss.str(eachline);
-    iss >> eachword;
-
-    Uint lev = 0;
-    bool tag = 0;
-    while (iss >> eachword) {
-      ++lev;
-      if (eachword == "NA") continue;
-
-      size_t pos = eachword.find('(');
-      float conf = atof(eachword.substr(pos+1, 5).c_str());
-      if (conf < cmdopts.confcut) continue;
-      string tname = eachword.substr(0, pos);
-      S2S::const_iterator citer = tid2name.find(tname);
-      if (citer != tid2name.end())
-	tname = citer->second;
-
-      S2I::iterator iter = abund[lev-1].find(tname);
-      if (iter == abund[lev-1].end())
-	abund[lev-1].insert(S2I::value_type(tname, 1));
-      else
-	++(iter->second);
-      
-      tag = true;
-      
-    }
-    if (tag) ++n;
+  // skip read ID, collapsed duplicates are counted as many times as copies
+  while (p < lend && *p != '\t' && *p != ' ') ++p;
+  Uint weight = readWeight(eachline.c_str(), p);
+
+  // reads of a sample are mostly next to each other
+  if (cmdopts.sampledelims != "") {
+    const char *kbeg, *kend;
+    sampleKey(cmdopts, eachline.c_str(), p, kbeg, kend);
+    if (chunk.counts == NULL || chunk.key.compare(0, string::npos, kbeg, kend - kbeg) != 0) {
+      chunk.key.assign(kbeg, kend);
+      chunk.counts = &sampleCounts(chunk, chunk.key);
+    }
+  }
+  Counts *counts = chunk.counts;
+
+  Uint lev = 0;
+  bool tag = 0;
+  while (p < lend) {
+
+    // next word
+    while (p < lend && (*p == '\t' || *p == ' ')) ++p;
+    if (p == lend) break;
+    const char *wbeg = p;
+    while (p < lend && *p != '\t' && *p != ' ') ++p;
+
+    ++lev;
+    if (lev > tree.nlevs) break;
+    if (p - wbeg == 2 && wbeg[0] == 'N' && wbeg[1] == 'A') continue;
+
+    const char *paren = wbeg;
+    while (paren < p && *paren != '(') ++paren;
+    char confstr[6] = "";   // as much of the score as before: 5 characters
+    if (paren < p)
+      strncat(confstr, paren+1, std::min<ptrdiff_t>(p-paren-1, 5));
+    float conf = atof(confstr);
+    if (conf < cmdopts.confcut) continue;
+
+    // lowest classified level, its ancestors are counted in the roll up
+    if (!tag && !tree.label.empty()) {
+      Uint node = findNode(tree, lev-1, wbeg, paren);
+      if (node != NONE) {
+	counts->nodes[node] += weight;
+	tag = true;
+	break;
+      }
+    }
+
+    Uint tid;
+    if (parseTid(wbeg, paren, tid))
+      counts->tids[lev-1][tid] += weight;
+    else
+      counts->labels[lev-1][string(wbeg, paren)] += weight;
+    
+    tag = true;
     
   }
-  return n;
+  if (tag) counts->n += weight;
 }
 
-void gettnames(string tnamesfn, S2S &tid2name) {
 
-  ifstream ifs(tnamesfn.c_str());
-  if (!ifs) {
-    cerr << "Could not open file " << tnamesfn << endl;
+// count reads of a classification as it is written, standard input if "-",
+// and rewrite profiles every so many seconds or reads; a file is read until
+// <classification>.done exists (as of metaphyler.pl), standard input (also
+// redirected from a file) or a pipe until it ends.
+// A snapshot takes time in the number of taxa, not of reads so far, as
+// reads are counted once on arrival.
+void follow(const Cmdopts &cmdopts, const Tree &tree, const TaxNames &tnames) {
+
+  int fd = cmdopts.clsffn == "-" ? 0 : open(cmdopts.clsffn.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    cerr << "Could not open file " << cmdopts.clsffn << endl;
     exit(1);
   }
+  // standard input ends where it ends, even when redirected from a file
+  bool growing = cmdopts.clsffn != "-" && S_ISREG(st.st_mode);
+  string donefn = cmdopts.clsffn + ".done";
+
+  Chunk chunk;
+  chunk.cmdopts = &cmdopts;
+  chunk.tree    = &tree;
+  chunk.counts  = cmdopts.sampledelims == "" ? &sampleCounts(chunk, "") : NULL;
+
+  char   buf[1 << 16];
+  string partial;          // a line not yet written to its end
+  Uint   nreads = 0;       // since the last snapshot
+  time_t last   = time(NULL);
+  bool   done   = false;
+  while (true) {
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len < 0) {
+      cerr << "Could not read file " << cmdopts.clsffn << endl;
+      exit(1);
+    }
 
-  string eachline, tid, tname;
-  istringstream iss;
-  while (getline(ifs, eachline)) {
-    iss.clear();
-    iss.str(eachline);
-    iss >> tid >> tname;
-    tid2name.insert(S2S::value_type(tid, tname));
+    if (len > 0) {
+      partial.append(buf, len);
+      size_t beg = 0, end;
+      while ((end = partial.find('\n', beg)) != string::npos) {
+	countLine(chunk, partial.substr(beg, end - beg));
+	beg = end + 1;
+	if (cmdopts.snapreads > 0 && ++nreads >= cmdopts.snapreads) {
+	  snapshot(cmdopts, tree, tnames, chunk);
+	  nreads = 0;
+	  last   = time(NULL);
+	}
+      }
+      partial.erase(0, beg);
+    }
+    // at the end so far: read once more after the file is done
+    else if (!growing || done)
+      break;
+    else if (!(done = access(donefn.c_str(), F_OK) == 0))
+      usleep(200000);
+
+    if (cmdopts.snapsecs > 0 && time(NULL) - last >= (time_t) cmdopts.snapsecs) {
+      snapshot(cmdopts, tree, tnames, chunk);
+      nreads = 0;
+      last   = time(NULL);
+    }
+  }
+  if (fd != 0) close(fd);
+
+  if (!partial.empty())
+    countLine(chunk, partial);
+  snapshot(cmdopts, tree, tnames, chunk);
+}
+
+
+// write profiles of reads counted so far, leaving the counts as they are
+void snapshot(const Cmdopts &cmdopts, const Tree &tree, const TaxNames &tnames, const Chunk &chunk) {
+
+  S2P profiles;
+  for (S2C::const_iterator siter = chunk.samples.begin(); siter != chunk.samples.end(); ++siter) {
+    Counts total = siter->second;
+    Profile &profile = profiles[siter->first];
+    profile.abund.assign(tree.nlevs, S2L());
+    profile.n = total.n;
+    resolveNames(tree, tnames, total, profile.abund);
   }
+  writeProfiles(cmdopts, profiles);
+}
+
+
+// read taxonomy file (gene ID, then labels from the lowest to the highest level)
+// or a database compiled from it
+// nodes are numbered level by level, so that children come before parents
+void readTree(string taxfn, Tree &tree) {
+
+  Taxonomy tax;
+  string   err;
+  if (tax.read(taxfn, err) <= 0) {
+    cerr << err << endl;
+    exit(1);
+  }
+
+  for (Uint gene = 0; gene < tax.ngenes(); ++gene)
+    if (tax.nlabs(gene) > tree.nlevs)
+      tree.nlevs = tax.nlabs(gene);
+
+  // nodes of each level
+  for (Uint lev = 0; lev < tree.nlevs; ++lev)
+    for (Uint gene = 0; gene < tax.ngenes(); ++gene)
+      if (lev < tax.nlabs(gene) && tax.labelAt(gene, lev) != TAXDBNONE)
+	addNode(tree, lev, tax.label(gene, lev));
+
+  // parents, the first lineage a node is seen in decides
+  tree.parent.assign(tree.label.size(), NONE);
+  vector<bool> done(tree.label.size(), false);
+  for (Uint gene = 0; gene < tax.ngenes(); ++gene) {
+    Uint child = NONE;
+    for (Uint lev = 0; lev < tax.nlabs(gene); ++lev) {
+      if (tax.labelAt(gene, lev) == TAXDBNONE) continue;
+      const char *label = tax.label(gene, lev);
+      Uint node = findNode(tree, lev, label, label + strlen(label));
+      if (child != NONE && !done[child]) {
+	tree.parent[child] = node;
+	done[child] = true;
+      }
+      child = node;
+    }
+    if (child != NONE)
+      done[child] = true;
+  }
+}
+
+
+// add a node, if it is not in the tree yet
+Uint addNode(Tree &tree, Uint lev, const string &label) {
+
+  Uint node = findNode(tree, lev, label.c_str(), label.c_str() + label.size());
+  if (node != NONE) return node;
+
+  node = tree.label.size();
+  Uint tid;
+  if (parseTid(label.c_str(), label.c_str() + label.size(), tid))
+    tree.tid2node.insert(unordered_map<uint64_t, Uint>::value_type((uint64_t) lev << 32 | tid, node));
+  else {
+    char levstr[16];
+    snprintf(levstr, sizeof(levstr), "%u ", lev);
+    tree.label2node.insert(S2I::value_type(levstr + label, node));
+  }
+  tree.level.push_back(lev);
+  tree.label.push_back(label);
+  return node;
+}
+
+
+// node of a label at a level, NONE if not in the tree
+Uint findNode(const Tree &tree, Uint lev, const char *beg, const char *end) {
+
+  Uint tid;
+  if (parseTid(beg, end, tid)) {
+    unordered_map<uint64_t, Uint>::const_iterator citer = tree.tid2node.find((uint64_t) lev << 32 | tid);
+    return citer == tree.tid2node.end() ? NONE : citer->second;
+  }
+
+  char levstr[16];
+  snprintf(levstr, sizeof(levstr), "%u ", lev);
+  S2I::const_iterator citer = tree.label2node.find(levstr + string(beg, end));
+  return citer == tree.label2node.end() ? NONE : citer->second;
+}
+
+
+// numeric taxonomy ID, as written out (no leading zeros)
+inline bool parseTid(const char *beg, const char *end, Uint &tid) {
+
+  if (beg == end || end - beg > 9 || (*beg == '0' && end - beg > 1))
+    return false;
+
+  tid = 0;
+  for (const char *p = beg; p < end; ++p) {
+    if (*p < '0' || *p > '9') return false;
+    tid = tid*10 + (*p - '0');
+  }
+  return true;
+}
+
+// number of reads a read ID stands for: N of ";size=N" written by dedup, or 1
+inline Uint readWeight(const char *beg, const char *end) {
+
+  static const char *TAG = ";size=";
+  const char *p = end;
+  while (p > beg && p[-1] >= '0' && p[-1] <= '9') --p;
+  if (p == end || p - beg < 6 || strncmp(p-6, TAG, 6) != 0)
+    return 1;
+
+  Uint weight = 0;
+  for (; p < end; ++p)
+    weight = weight*10 + (*p - '0');
+  return weight > 0 ? weight : 1;
 }
 
 // parse command line options
 void getcmdopts(int argc, char *argv[], Cmdopts &cmdopts) {
 
+  cmdopts.nthreads = 1;
+  cmdopts.tol      = -1;
+  cmdopts.samplefield = 1;
+  cmdopts.snapsecs  = 0;
+  cmdopts.snapreads = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:T:r:e:l:w:m:s:k:f:n:")) != -1) {
+    switch (opt) {
+    case 't': cmdopts.nthreads = atoi(optarg); break;
+    case 'T': cmdopts.taxfn    = optarg; break;
+    case 'r': cmdopts.statefn  = optarg; break;
+    case 'e': cmdopts.tol      = atof(optarg); break;
+    case 'l': cmdopts.convlevs = optarg; break;
+    case 'w': cmdopts.outstatefn = optarg; break;
+    case 'm': cmdopts.mergefns.push_back(optarg); break;
+    case 's': cmdopts.sampledelims = optarg; break;
+    case 'k': cmdopts.samplefield  = atoi(optarg); break;
+    case 'f': cmdopts.snapsecs     = atoi(optarg); break;
+    case 'n': cmdopts.snapreads    = atoi(optarg); break;
+    default:  helpmsg(); exit(1);
+    }
+  }
+  if (cmdopts.nthreads == 0) cmdopts.nthreads = 1;
+  bool following = cmdopts.snapsecs > 0 || cmdopts.snapreads > 0;
+  if (cmdopts.samplefield == 0 || (cmdopts.sampledelims != "" && !cmdopts.mergefns.empty())
+      || (following && (!cmdopts.mergefns.empty() || cmdopts.statefn != ""))) {
+    helpmsg();
+    exit(1);
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  // merging states: only an output prefix, if profiles are wanted
+  if (!cmdopts.mergefns.empty()) {
+    if (argc > 2 || (argc == 1 && cmdopts.outstatefn == "")) {
+      helpmsg();
+      exit(1);
+    }
+    cmdopts.prefix = argc == 2 ? argv[1] : "";
+    return;
+  }
+
   if (argc != 5 && argc != 4) {
     helpmsg();
     exit(1);
@@ -178,7 +787,9 @@ void helpmsg() {
   cerr << endl;
 
   cerr << "Usage:" << endl;
-  cerr << "        ./taxprof <conf. cutoff> <classification> <prefix> <taxonomy names>" << endl;
+  cerr << "        ./taxprof [-t <threads>] [-T <taxonomy>] [-r <state>] [-e <tolerance>] [-l <levels>] [-w <state>] [-s <delimiters> [-k <field>]] <conf. cutoff> <classification> <prefix> <taxonomy names>" << endl;
+  cerr << "        ./taxprof -m <state> [-m <state> ...] [-w <state>] [-e <tolerance>] [-l <levels>] [<prefix>]" << endl;
+  cerr << "        ./taxprof -f <seconds> | -n <reads> [options] <conf. cutoff> <classification> <prefix> <taxonomy names>" << endl;
   cerr << endl;
 
   cerr << "Options:" << endl;
@@ -188,10 +799,40 @@ void helpmsg() {
   cerr << "        <prefix>         Output files prefix." << endl;
   cerr << "        <taxonomy names> File: 1st column, taxonomy ID; 2nd, name." << endl;
   cerr << "                         If omitted, output will just use taxonomy IDs." << endl;;
+  cerr << "                         A database compiled by taxdb can be given here and with -T." << endl;
+  cerr << "        -t <threads>     Number of threads to count reads (default: 1)." << endl;
+  cerr << "        -T <taxonomy>    Taxonomy labels of reference genes (e.g., markers.taxonomy)." << endl;
+  cerr << "                         A read is counted at its lowest classified level, and at all" << endl;
+  cerr << "                         ancestors of that taxon in the tree, so profiles are nested." << endl;
+  cerr << "        -r <state>       Running profile of previous batches of reads. Counts are added" << endl;
+  cerr << "                         to it, and profiles are of all batches so far." << endl;
+  cerr << "        -e <tolerance>   Print 95% confidence intervals, and check whether all of them are" << endl;
+  cerr << "                         within +/- tolerance percent. Prints \"converged\" or \"running\"," << endl;
+  cerr << "                         the number of reads counted, and the largest half width." << endl;
+  cerr << "        -l <levels>      Levels checked with -e, e.g., phylum,class,genus (default: all)." << endl;
+  cerr << "        -w <state>       Write the read counts, e.g., of one shard of a sample, to a state" << endl;
+  cerr << "                         file. States of shards are merged exactly with -m." << endl;
+  cerr << "        -m <state>       Add up the counts of state files (-w or -r), given once each," << endl;
+  cerr << "                         instead of reading a classification. With -w, merged counts" << endl;
+  cerr << "                         can be merged again; profiles are the same as of one run." << endl;
+  cerr << "        -s <delimiters>  Reads of many samples in one classification: the sample of a read" << endl;
+  cerr << "                         is a field of its ID, split at any of these characters" << endl;
+  cerr << "                         (e.g., _ for S01_read7). Each sample gets its own profiles," << endl;
+  cerr << "                         prefix.<sample>.<level>.taxprof, and -r/-w states, <state>.<sample>;" << endl;
+  cerr << "                         -e prints a line for each sample. Reads without the field are" << endl;
+  cerr << "                         in sample \"unassigned\". Not with -m; merge states of a sample." << endl;
+  cerr << "        -k <field>       Field of the read ID naming the sample, from 1 (default: 1)." << endl;
+  cerr << "        -f <seconds>     Follow a classification as it is written (- for standard input)," << endl;
+  cerr << "                         and rewrite profiles, -w state and -e line every so many seconds." << endl;
+  cerr << "                         A file is followed until <classification>.done exists, - or a" << endl;
+  cerr << "                         pipe until it ends; profiles are then final. Not with -r or -m." << endl;
+  cerr << "        -n <reads>       Follow as with -f, and rewrite profiles every so many reads." << endl;
 
   cerr << "Output files:" << endl;
   cerr << "        prefix.<genus|family|order|class|phylum>.taxprof." << endl;
-  cerr << "                         Taxonomy profiles at each level." << endl << endl;;
+  cerr << "                         Taxonomy profiles at each level." << endl;
+  cerr << "        prefix.<sample>.<genus|family|order|class|phylum>.taxprof." << endl;
+  cerr << "                         With -s, profiles of each sample." << endl << endl;;
   
   
   cerr << "Contact:" << endl;
@@ -0,0 +1,48 @@
+// Bit scores of SAM records of known alignments, as metaphylerClassify
+// reads them, against the bit scores blastall -p blastn (-m8 column 12)
+// reports for the same alignments with its default scores
+//
+// g++ -o testHits testHits.cpp && ./testHits
+
+#include <iostream>
+using std::cout;
+using std::endl;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include "../src/hits.h"
+
+struct Known {
+  const char *sam;
+  unsigned    bits;        // as blastall prints them, without decimals
+};
+
+const Known KNOWN[] = {
+  {"r1\t0\tg\t1\t60\t20M\t*\t0\t0\t*\t*\tNM:i:0",      40},   // 40.1 bits (20)
+  {"r2\t0\tg\t1\t60\t22M\t*\t0\t0\t*\t*\tNM:i:0",      44},   // 44.1 bits (22)
+  {"r3\t0\tg\t1\t60\t50M\t*\t0\t0\t*\t*\tNM:i:0",      99},   // 99.6 bits (50)
+  {"r4\t16\tg\t1\t60\t5S77M\t*\t0\t0\t*\t*\tNM:i:0",  153},   // 153 bits (77)
+  {"r5\t0\tg\t1\t60\t100M\t*\t0\t0\t*\t*\tNM:i:0",    198},   // 198 bits (100)
+  {"r6\t0\tg\t1\t60\t100M\t*\t0\t0\t*\t*\tNM:i:5",    159},   // 159 bits (80), 95 of 100
+  {"r7\t0\tg\t1\t60\t60M1I40M\t*\t0\t0\t*\t*\tNM:i:1", 184}, // 184 bits (93), one gap
+};
+
+
+int main() {
+
+  vector<string> nomates;
+  string line;
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(KNOWN) / sizeof(KNOWN[0]); ++i) {
+    if (!samToM8(KNOWN[i].sam, nomates, line) || m8Bits(line) != KNOWN[i].bits) {
+      cout << "FAIL " << KNOWN[i].sam << " -> " << line << ", blastall: " << KNOWN[i].bits << endl;
+      ++failed;
+    }
+  }
+  cout << (failed ? "failed" : "ok") << endl;
+  return failed ? 1 : 0;
+}